@@ -0,0 +1,129 @@
+//
+//  Compiler.cpp
+//  uscc
+//
+//  Implements the libuscc in-memory compilation API.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+
+#include "Compiler.h"
+#include "../parse/Parse.h"
+#include "../parse/Emitter.h"
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#pragma clang diagnostic pop
+
+using namespace uscc;
+
+Compilation::Compilation(const std::string& source, const char* name /* = "<memory>" */,
+						 bool optimize /* = false */)
+: mOwnedContext(new llvm::LLVMContext())
+, mContext(*mOwnedContext)
+{
+	compile(source, name, optimize);
+}
+
+Compilation::Compilation(const std::string& source, llvm::LLVMContext& context,
+						 const char* name /* = "<memory>" */, bool optimize /* = false */)
+: mContext(context)
+{
+	compile(source, name, optimize);
+}
+
+Compilation::~Compilation()
+{
+	// The module has to go before the context it was created in
+	mEmitter.reset();
+	mParser.reset();
+	mOwnedContext.reset();
+}
+
+void Compilation::compile(const std::string& source, const char* name, bool optimize)
+{
+	// Errors are collected rather than printed. The parser reports any
+	// ParseExcept itself, and there's no file that could be missing.
+	mParser.reset(new parse::Parser(source, name, nullptr, nullptr, false));
+	
+	if (!mParser->IsValid())
+	{
+		for (auto error : mParser->GetErrors())
+		{
+			mDiagnostics.emplace_back(error->mMsg, error->mLineNum, error->mColNum);
+		}
+		return;
+	}
+	
+	mEmitter.reset(new parse::Emitter(*mParser, mContext));
+	
+	if (optimize)
+	{
+		mEmitter->optimize();
+	}
+	
+	if (!mEmitter->verify())
+	{
+		mDiagnostics.emplace_back("Emitted bad IR. Compilation halted.", 0, 0);
+		mEmitter.reset();
+	}
+}
+
+bool Compilation::getBitcode(std::string& buffer)
+{
+	if (!mEmitter)
+	{
+		return false;
+	}
+	
+	llvm::raw_string_ostream output(buffer);
+	mEmitter->writeBitcode(output);
+	output.flush();
+	return true;
+}
+
+bool Compilation::getIR(std::string& buffer)
+{
+	if (!mEmitter)
+	{
+		return false;
+	}
+	
+	llvm::raw_string_ostream output(buffer);
+	mEmitter->print(output);
+	output.flush();
+	return true;
+}
+
+bool Compilation::getAssembly(std::string& buffer, unsigned long numColors /* = 4 */)
+{
+	if (!mEmitter)
+	{
+		return false;
+	}
+	
+	llvm::raw_string_ostream output(buffer);
+	bool success = mEmitter->writeAsm(output, numColors);
+	output.flush();
+	return success;
+}
+
+std::unique_ptr<llvm::Module> Compilation::takeModule()
+{
+	std::unique_ptr<llvm::Module> mod;
+	if (mEmitter)
+	{
+		mod.reset(mEmitter->releaseModule());
+		mEmitter.reset();
+	}
+	
+	return mod;
+}
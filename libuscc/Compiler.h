@@ -0,0 +1,120 @@
+//
+//  Compiler.h
+//  uscc
+//
+//  Declares the libuscc API, which compiles USC source
+//  held in memory without touching the file system.
+//
+//  Each Compilation has its own LLVM context (unless one
+//  is supplied), so separate Compilations can run on
+//  separate threads.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+
+namespace llvm
+{
+	class LLVMContext;
+	class Module;
+}
+
+namespace uscc
+{
+
+namespace parse
+{
+	class Parser;
+	class Emitter;
+}
+
+// A single error reported during compilation
+struct Diagnostic
+{
+	Diagnostic(const std::string& msg, int lineNum, int colNum)
+	: mMsg(msg)
+	, mLineNum(lineNum)
+	, mColNum(colNum)
+	{ }
+	
+	std::string mMsg;
+	// Line/column are 1-based, and 0 if the error isn't tied
+	// to a location in the source (such as bad emitted IR)
+	int mLineNum;
+	int mColNum;
+};
+
+class Compilation
+{
+public:
+	// Parses, checks and emits the source in its own LLVM context.
+	// The name is only used to identify the source in diagnostics.
+	Compilation(const std::string& source, const char* name = "<memory>",
+				bool optimize = false);
+	
+	// Like the above, but emits into a caller-owned LLVM context,
+	// which must outlive this Compilation (and any taken module)
+	Compilation(const std::string& source, llvm::LLVMContext& context,
+				const char* name = "<memory>", bool optimize = false);
+	
+	~Compilation();
+	
+	// Returns true if there were no errors, in which case
+	// the module is available
+	bool isValid() const noexcept
+	{
+		return mDiagnostics.size() == 0;
+	}
+	
+	const std::vector<Diagnostic>& getDiagnostics() const noexcept
+	{
+		return mDiagnostics;
+	}
+	
+	// Writes the LLVM bitcode to the buffer.
+	// Returns false if there's no valid module.
+	bool getBitcode(std::string& buffer);
+	
+	// Writes the human readable LLVM IR to the buffer.
+	// Returns false if there's no valid module.
+	bool getIR(std::string& buffer);
+	
+	// Writes native assembly to the buffer.
+	// Returns false if there's no valid module or codegen failed.
+	bool getAssembly(std::string& buffer, unsigned long numColors = 4);
+	
+	// Hands ownership of the module to the caller, or returns
+	// nullptr if there's no valid module. The module belongs to
+	// this Compilation's LLVM context, so if the context isn't
+	// caller-owned, the Compilation must outlive the module.
+	std::unique_ptr<llvm::Module> takeModule();
+	
+private:
+	// Disallow copy/assignment
+	Compilation(const Compilation& copy) = delete;
+	Compilation& operator=(const Compilation& rhs) = delete;
+	
+	// Does the actual work for both constructors
+	void compile(const std::string& source, const char* name, bool optimize);
+	
+	// Only set if we weren't given a context
+	std::unique_ptr<llvm::LLVMContext> mOwnedContext;
+	llvm::LLVMContext& mContext;
+	
+	std::unique_ptr<parse::Parser> mParser;
+	std::unique_ptr<parse::Emitter> mEmitter;
+	
+	std::vector<Diagnostic> mDiagnostics;
+};
+
+} // uscc
@@ -0,0 +1,187 @@
+//
+//  CompilerTest.cpp
+//  uscc
+//
+//  Test driver for the libuscc API. Each case is selected by
+//  name on the command line (see tests/testLibuscc.py), and
+//  the driver exits with 0 if the case passes. Otherwise it
+//  prints what went wrong and exits with 1.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+
+#include "Compiler.h"
+#include <iostream>
+#include <string>
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#pragma clang diagnostic pop
+
+using namespace uscc;
+
+namespace
+{
+
+const char* VALID_SOURCE =
+	"int main()\n"
+	"{\n"
+	"\tprintf(\"%d\\n\", 6 * 7);\n"
+	"\treturn 0;\n"
+	"}\n";
+
+// x is redeclared on line 4, column 6
+const char* SEMANT_ERROR_SOURCE =
+	"int main()\n"
+	"{\n"
+	"\tint x;\n"
+	"\tint x;\n"
+	"\treturn x;\n"
+	"}\n";
+
+// Prints the message if the condition doesn't hold
+bool check(bool condition, const char* msg)
+{
+	if (!condition)
+	{
+		std::cout << "FAILED: " << msg << std::endl;
+	}
+	return condition;
+}
+
+bool testValid()
+{
+	Compilation comp(VALID_SOURCE, "valid.usc");
+	if (!check(comp.isValid(), "valid source has diagnostics"))
+	{
+		for (auto& diag : comp.getDiagnostics())
+		{
+			std::cout << diag.mLineNum << ":" << diag.mColNum << ": " << diag.mMsg << std::endl;
+		}
+		return false;
+	}
+	
+	bool passed = true;
+	
+	std::string bitcode;
+	passed &= check(comp.getBitcode(bitcode), "getBitcode returned false");
+	passed &= check(bitcode.compare(0, 4, "BC\xC0\xDE") == 0,
+					"bitcode doesn't start with the bitcode magic number");
+	
+	std::string ir;
+	passed &= check(comp.getIR(ir), "getIR returned false");
+	passed &= check(ir.find("define i32 @main()") != std::string::npos,
+					"IR doesn't define main");
+	passed &= check(ir.find("@printf") != std::string::npos,
+					"IR doesn't declare printf");
+	
+	std::string assembly;
+	passed &= check(comp.getAssembly(assembly), "getAssembly returned false");
+	passed &= check(assembly.find("main:") != std::string::npos,
+					"assembly doesn't have a main label");
+	
+	return passed;
+}
+
+bool testDiagnostics()
+{
+	Compilation comp(SEMANT_ERROR_SOURCE, "error.usc");
+	if (!check(!comp.isValid(), "source with a semantic error is valid"))
+	{
+		return false;
+	}
+	
+	const auto& diags = comp.getDiagnostics();
+	if (!check(diags.size() == 1, "expected exactly one diagnostic"))
+	{
+		return false;
+	}
+	
+	bool passed = true;
+	passed &= check(diags[0].mMsg == "Invalid redeclaration of identifier 'x'",
+					"wrong diagnostic message");
+	passed &= check(diags[0].mLineNum == 4, "wrong diagnostic line");
+	passed &= check(diags[0].mColNum == 6, "wrong diagnostic column");
+	
+	// None of the outputs are available without a module
+	std::string buffer;
+	passed &= check(!comp.getBitcode(buffer), "getBitcode succeeded with errors");
+	passed &= check(!comp.getIR(buffer), "getIR succeeded with errors");
+	passed &= check(!comp.getAssembly(buffer), "getAssembly succeeded with errors");
+	passed &= check(comp.takeModule() == nullptr, "takeModule succeeded with errors");
+	return passed;
+}
+
+bool testTakeModule()
+{
+	llvm::LLVMContext context;
+	std::unique_ptr<llvm::Module> module;
+	bool passed = true;
+	{
+		Compilation comp(VALID_SOURCE, context, "valid.usc");
+		if (!check(comp.isValid(), "valid source has diagnostics"))
+		{
+			return false;
+		}
+		
+		module = comp.takeModule();
+		
+		// The module was handed over, so there's nothing left to output
+		std::string ir;
+		passed &= check(!comp.getIR(ir), "getIR succeeded after takeModule");
+		passed &= check(comp.takeModule() == nullptr, "takeModule succeeded twice");
+	}
+	
+	// The Compilation is gone, but the module lives on in our context
+	if (!check(module != nullptr, "takeModule returned nullptr"))
+	{
+		return false;
+	}
+	
+	passed &= check(&module->getContext() == &context,
+					"module isn't in the caller's context");
+	passed &= check(module->getFunction("main") != nullptr,
+					"module doesn't have main");
+	passed &= check(!llvm::verifyModule(*module), "module doesn't verify");
+	return passed;
+}
+
+} // anonymous namespace
+
+int main(int argc, const char* argv[])
+{
+	if (argc != 2)
+	{
+		std::cout << "usage: compilertest <valid|diagnostics|takemodule>" << std::endl;
+		return 1;
+	}
+	
+	std::string testName(argv[1]);
+	bool passed = false;
+	if (testName == "valid")
+	{
+		passed = testValid();
+	}
+	else if (testName == "diagnostics")
+	{
+		passed = testDiagnostics();
+	}
+	else if (testName == "takemodule")
+	{
+		passed = testTakeModule();
+	}
+	else
+	{
+		std::cout << "Unknown test " << testName << std::endl;
+	}
+	
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+//
+//  ADCE.cpp
+//  uscc
+//
+//  Implements aggressive dead code elimination --
+//  Every instruction starts out dead. Instructions with
+//  side effects (stores, calls, returns and branches) are
+//  live, and so is anything a live instruction uses.
+//  Whatever isn't marked live is removed, including
+//  cycles of phis that only use each other.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#pragma clang diagnostic pop
+#include <unordered_set>
+#include <vector>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+bool ADCE::runOnFunction(Function& F)
+{
+	std::unordered_set<Instruction*> liveSet;
+	std::vector<Instruction*> worklist;
+	
+	// Anything with an effect outside of its value is live.
+	// Branches are kept as well, since this pass leaves the CFG alone.
+	for (BasicBlock& block : F)
+	{
+		for (Instruction& inst : block)
+		{
+			if (isa<TerminatorInst>(&inst) || inst.mayHaveSideEffects())
+			{
+				liveSet.insert(&inst);
+				worklist.push_back(&inst);
+			}
+		}
+	}
+	
+	// Anything a live instruction uses is live, too
+	while (!worklist.empty())
+	{
+		Instruction* inst = worklist.back();
+		worklist.pop_back();
+		for (Value* op : inst->operands())
+		{
+			Instruction* opInst = dyn_cast<Instruction>(op);
+			if (opInst != nullptr && liveSet.insert(opInst).second)
+			{
+				worklist.push_back(opInst);
+			}
+		}
+	}
+	
+	std::vector<Instruction*> removeList;
+	for (BasicBlock& block : F)
+	{
+		for (Instruction& inst : block)
+		{
+			if (liveSet.count(&inst) == 0)
+			{
+				removeList.push_back(&inst);
+			}
+		}
+	}
+	
+	// Dead instructions may use each other (like a phi cycle),
+	// so drop all of their operands before erasing any of them
+	for (Instruction* inst : removeList)
+	{
+		inst->dropAllReferences();
+	}
+	
+	for (Instruction* inst : removeList)
+	{
+		inst->eraseFromParent();
+	}
+	
+	return !removeList.empty();
+}
+
+void ADCE::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// ADCE does not modify the CFG
+	Info.setPreservesCFG();
+	// Execute after redundant values have been removed
+	Info.addRequired<GVN>();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::ADCE::ID = 0;
@@ -3,8 +3,9 @@
 //  uscc
 //
 //  Implements constant propagation --
-//  If a binary op or an icmp is operating on constants,
-//  replace the instruction with the computed result
+//  If a binary op, an icmp or a cast is operating on constants,
+//  replace the instruction with the computed result. Users of
+//  a folded instruction are revisited until nothing changes.
 //
 //---------------------------------------------------------
 //  Copyright (c) 2014, Sanjay Madhav
@@ -20,7 +21,8 @@
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Constants.h>
 #pragma clang diagnostic pop
-#include <set>
+#include <vector>
+#include <algorithm>
 
 using namespace llvm;
 
@@ -29,125 +31,192 @@ namespace uscc
 namespace opt
 {
 
-bool ConstantOps::runOnFunction(Function& F) {
-	bool changed = false;
-	
-	// Make a set that contains the instructions we'll remove
-	std::set<Instruction*> removeSet;
-	
-	// Loop through each block
-	Function::iterator blockIter = F.begin();
-	while (blockIter != F.end())
+namespace
+{
+
+// Computes a binary op on two constants of the same width.
+// Returns false if the result is undefined (like a division by zero).
+bool foldBinaryOp(Instruction::BinaryOps opcode, const APInt& lhs,
+				  const APInt& rhs, APInt& result)
+{
+	switch (opcode)
+	{
+		case Instruction::Add:
+			result = lhs + rhs;
+			return true;
+		case Instruction::Sub:
+			result = lhs - rhs;
+			return true;
+		case Instruction::Mul:
+			result = lhs * rhs;
+			return true;
+		case Instruction::SDiv:
+		case Instruction::SRem:
+			// Leave these for the program to trap on at runtime
+			if (rhs == 0 || (lhs.isMinSignedValue() && rhs.isAllOnesValue()))
+			{
+				return false;
+			}
+			result = (opcode == Instruction::SDiv) ? lhs.sdiv(rhs) : lhs.srem(rhs);
+			return true;
+		case Instruction::UDiv:
+		case Instruction::URem:
+			if (rhs == 0)
+			{
+				return false;
+			}
+			result = (opcode == Instruction::UDiv) ? lhs.udiv(rhs) : lhs.urem(rhs);
+			return true;
+		case Instruction::And:
+			result = lhs & rhs;
+			return true;
+		case Instruction::Or:
+			result = lhs | rhs;
+			return true;
+		case Instruction::Xor:
+			result = lhs ^ rhs;
+			return true;
+		default:
+			// For everything else, we don't do a calculation
+			return false;
+	}
+}
+
+// Computes an icmp on two constants of the same width
+bool foldCompare(CmpInst::Predicate pred, const APInt& lhs, const APInt& rhs)
+{
+	switch (pred)
+	{
+		case CmpInst::ICMP_EQ:
+			return lhs == rhs;
+		case CmpInst::ICMP_NE:
+			return lhs != rhs;
+		case CmpInst::ICMP_SGT:
+			return lhs.sgt(rhs);
+		case CmpInst::ICMP_SGE:
+			return lhs.sge(rhs);
+		case CmpInst::ICMP_SLT:
+			return lhs.slt(rhs);
+		case CmpInst::ICMP_SLE:
+			return lhs.sle(rhs);
+		case CmpInst::ICMP_UGT:
+			return lhs.ugt(rhs);
+		case CmpInst::ICMP_UGE:
+			return lhs.uge(rhs);
+		case CmpInst::ICMP_ULT:
+			return lhs.ult(rhs);
+		case CmpInst::ICMP_ULE:
+			return lhs.ule(rhs);
+		default:
+			// Not an integer predicate
+			return false;
+	}
+}
+
+// Returns the constant this instruction computes,
+// or nullptr if it can't be folded
+ConstantInt* foldInstruction(Instruction* inst)
+{
+	if (BinaryOperator* binOp = dyn_cast<BinaryOperator>(inst))
 	{
-		// Loop through instructions in block
-		BasicBlock::iterator instrIter = blockIter->begin();
-		while (instrIter != blockIter->end())
+		ConstantInt* lhs = dyn_cast<ConstantInt>(binOp->getOperand(0));
+		ConstantInt* rhs = dyn_cast<ConstantInt>(binOp->getOperand(1));
+		APInt result;
+		if (lhs != nullptr && rhs != nullptr &&
+			foldBinaryOp(binOp->getOpcode(), lhs->getValue(), rhs->getValue(), result))
 		{
-			// Is this a binary op?
-			if (BinaryOperator* binOp = dyn_cast<BinaryOperator>(instrIter))
+			return ConstantInt::get(inst->getContext(), result);
+		}
+	}
+	else if (ICmpInst* icmpOp = dyn_cast<ICmpInst>(inst))
+	{
+		ConstantInt* lhs = dyn_cast<ConstantInt>(icmpOp->getOperand(0));
+		ConstantInt* rhs = dyn_cast<ConstantInt>(icmpOp->getOperand(1));
+		if (lhs != nullptr && rhs != nullptr)
+		{
+			if (foldCompare(icmpOp->getPredicate(), lhs->getValue(), rhs->getValue()))
 			{
-				// Make sure both are constant ints and 32-bit
-				ConstantInt* lhs = dyn_cast<ConstantInt>(binOp->getOperand(0));
-				ConstantInt* rhs = dyn_cast<ConstantInt>(binOp->getOperand(1));
-				if (lhs != nullptr && rhs != nullptr &&
-					lhs->getValue().isSignedIntN(32) && rhs->getValue().isSignedIntN(32))
-				{
-					// Now do the calculation
-					APInt result = lhs->getValue();
-					bool didCalc = true;
-					switch (binOp->getOpcode())
-					{
-						case Instruction::Add:
-							result += rhs->getValue();
-							break;
-						case Instruction::Sub:
-							result -= rhs->getValue();
-							break;
-						case Instruction::Mul:
-							result *= rhs->getValue();
-							break;
-						default:
-							// For everything else, we didn't do a calculation
-							didCalc = false;
-							break;
-					}
-					
-					// If we did a calculation, replace this instruction now
-					if (didCalc)
-					{
-						removeSet.insert(instrIter);
-						instrIter->replaceAllUsesWith(ConstantInt::get(instrIter->getContext(), result));
-					}
-				}
+				return ConstantInt::getTrue(inst->getContext());
 			}
-			else if (ICmpInst* icmpOp = dyn_cast<ICmpInst>(instrIter))
+			else
 			{
-				// Is this one of our two desired predicates?
-				CmpInst::Predicate pred = icmpOp->getPredicate();
-				if (pred == CmpInst::ICMP_EQ || pred == CmpInst::ICMP_NE ||
-					pred == CmpInst::ICMP_SGT || pred == CmpInst::ICMP_SLT)
-				{
-					// Make sure both are constant 32-bit ints
-					ConstantInt* lhs = dyn_cast<ConstantInt>(icmpOp->getOperand(0));
-					ConstantInt* rhs = dyn_cast<ConstantInt>(icmpOp->getOperand(1));
-					if (lhs != nullptr && rhs != nullptr &&
-						lhs->getBitWidth() == 32 && rhs->getBitWidth() == 32)
-					{
-						
-						// Compute the instruction
-						bool result = false;
-						switch (pred)
-						{
-							case CmpInst::ICMP_EQ:
-								result = (lhs->getValue() == rhs->getValue());
-								break;
-							case CmpInst::ICMP_NE:
-								result = (lhs->getValue() != rhs->getValue());
-								break;
-							case CmpInst::ICMP_SGT:
-								result = lhs->getValue().sgt(rhs->getValue());
-								break;
-							case CmpInst::ICMP_SLT:
-								result = lhs->getValue().slt(rhs->getValue());
-								break;
-							default:
-								// Note: This case can never be hit because of earlier condition
-								break;
-						}
-						
-						// Replace the instruction
-						removeSet.insert(instrIter);
-						if (result)
-						{
-							instrIter->replaceAllUsesWith(ConstantInt::getTrue(instrIter->getContext()));
-						}
-						else
-						{
-							instrIter->replaceAllUsesWith(ConstantInt::getFalse(instrIter->getContext()));
-						}
-					}
-				}
+				return ConstantInt::getFalse(inst->getContext());
+			}
+		}
+	}
+	else if (CastInst* castOp = dyn_cast<CastInst>(inst))
+	{
+		// The emitter widens chars and bools, and narrows ints to chars
+		ConstantInt* val = dyn_cast<ConstantInt>(castOp->getOperand(0));
+		IntegerType* destType = dyn_cast<IntegerType>(castOp->getType());
+		if (val != nullptr && destType != nullptr)
+		{
+			unsigned width = destType->getBitWidth();
+			switch (castOp->getOpcode())
+			{
+				case Instruction::SExt:
+					return ConstantInt::get(inst->getContext(), val->getValue().sext(width));
+				case Instruction::ZExt:
+					return ConstantInt::get(inst->getContext(), val->getValue().zext(width));
+				case Instruction::Trunc:
+					return ConstantInt::get(inst->getContext(), val->getValue().trunc(width));
+				default:
+					break;
 			}
-			
-			++instrIter;
 		}
-		
-		++blockIter;
 	}
 	
-	// Now remove any instructions we flagged
-	if (removeSet.size() > 0)
+	return nullptr;
+}
+
+} // anonymous namespace
+
+bool ConstantOps::runOnFunction(Function& F) {
+	// Start out with every instruction in the function
+	std::vector<Instruction*> worklist;
+	for (BasicBlock& block : F)
 	{
-		changed = true;
-		for (std::set<Instruction*>::iterator i = removeSet.begin();
-			 i != removeSet.end();
-			 ++i)
+		for (Instruction& inst : block)
 		{
-			(*i)->eraseFromParent();
+			worklist.push_back(&inst);
 		}
 	}
 	
-	return changed;
+	// Instructions we'll remove. Nothing is erased until the end, because
+	// a folded instruction may still be waiting on the worklist.
+	std::vector<Instruction*> removeList;
+	while (!worklist.empty())
+	{
+		Instruction* inst = worklist.back();
+		worklist.pop_back();
+		
+		ConstantInt* result = foldInstruction(inst);
+		if (result == nullptr)
+		{
+			continue;
+		}
+		
+		// Any user might be foldable now that it has a new constant operand
+		for (User* user : inst->users())
+		{
+			worklist.push_back(cast<Instruction>(user));
+		}
+		
+		inst->replaceAllUsesWith(result);
+		removeList.push_back(inst);
+	}
+	
+	// An instruction can be folded more than once if it was queued twice
+	std::sort(removeList.begin(), removeList.end());
+	removeList.erase(std::unique(removeList.begin(), removeList.end()), removeList.end());
+	
+	// Now remove any instructions we flagged
+	for (Instruction* inst : removeList)
+	{
+		inst->eraseFromParent();
+	}
+	
+	return !removeList.empty();
 }
 
 void ConstantOps::getAnalysisUsage(AnalysisUsage& Info) const
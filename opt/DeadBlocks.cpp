@@ -17,9 +17,10 @@
 #pragma clang diagnostic ignored "-Wconversion"
 #include <llvm/IR/Function.h>
 #include <llvm/IR/CFG.h>
-#include <llvm/ADT/DepthFirstIterator.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/BitVector.h>
 #pragma clang diagnostic pop
-#include <set>
+#include <vector>
 
 using namespace llvm;
 
@@ -30,58 +31,70 @@ namespace opt
 	
 bool DeadBlocks::runOnFunction(Function& F)
 {
-	bool changed = false;
+	// Number the blocks, so the reachable set can be a bitvector
+	DenseMap<BasicBlock*, unsigned> blockNums;
+	unsigned numBlocks = 0;
+	for (BasicBlock& block : F)
+	{
+		blockNums[&block] = numBlocks++;
+	}
 	
-	// PA5: Implement
-    std::set<BasicBlock*> visitedBlock;
-    std::set<BasicBlock*> visitingBlock;
-    visitedBlock.insert(F.begin());
-    visitingBlock.insert(F.begin());
-    while (!visitingBlock.empty()) {
-        auto block = *(visitingBlock.begin());
-        visitingBlock.erase(block);
-        
-        if (visitedBlock.find(block) == visitedBlock.end()) {
-            visitedBlock.insert(block);
-        }
-        
-        for (auto it = succ_begin(block); it != succ_end(block); ++it) {
-            if (visitedBlock.find(block) == visitedBlock.end()) {
-                visitingBlock.insert(block);
-            }
-        }
-        for (auto it = succ_begin(block); it != succ_end(block); ++it) {
-            if (visitedBlock.find(*it) == visitedBlock.end()
-                && visitingBlock.find(*it) == visitingBlock.end()){
-                visitingBlock.insert(*it);
-            }
-        }
-        visitedBlock.insert(block);
-        visitingBlock.erase(block);
-    }
-    
-    std::set<BasicBlock*> unreachableSet;
-    for (auto it = F.begin(); it != F.end(); ++it) {
-        if (visitedBlock.find(it) == visitedBlock.end()) {
-            unreachableSet.insert(it);
-        }
-    }
-    
-    for (auto block : unreachableSet){
-        for (auto it = succ_begin(block); it != succ_end(block); ++it) {
-            it->removePredecessor(block);
-        }
-        block->eraseFromParent();
-    }
-
+	// Depth-first search from the entry block, so every
+	// edge is looked at once
+	BitVector reachable(numBlocks);
+	std::vector<BasicBlock*> stack;
+	reachable.set(blockNums[&F.getEntryBlock()]);
+	stack.push_back(&F.getEntryBlock());
+	while (!stack.empty())
+	{
+		BasicBlock* block = stack.back();
+		stack.pop_back();
+		for (auto it = succ_begin(block); it != succ_end(block); ++it)
+		{
+			unsigned num = blockNums[*it];
+			if (!reachable.test(num))
+			{
+				reachable.set(num);
+				stack.push_back(*it);
+			}
+		}
+	}
 	
-	return changed;
-}
+	std::vector<BasicBlock*> unreachableList;
+	for (BasicBlock& block : F)
+	{
+		if (!reachable.test(blockNums[&block]))
+		{
+			unreachableList.push_back(&block);
+		}
+	}
+	
+	// Unreachable blocks can branch to each other, so drop
+	// all of their references before erasing any of them
+	for (BasicBlock* block : unreachableList)
+	{
+		for (auto it = succ_begin(block); it != succ_end(block); ++it)
+		{
+			if (reachable.test(blockNums[*it]))
+			{
+				it->removePredecessor(block);
+			}
+		}
+		block->dropAllReferences();
+	}
 	
+	for (BasicBlock* block : unreachableList)
+	{
+		block->eraseFromParent();
+	}
+	
+	return !unreachableList.empty();
+}
+
 void DeadBlocks::getAnalysisUsage(AnalysisUsage& Info) const
 {
 	// PA5: Implement
-    Info.addRequired<ConstantBranch>();
+    Info.addRequired<SCCP>();
 }
 
 } // opt
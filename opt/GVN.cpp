@@ -0,0 +1,219 @@
+//
+//  GVN.cpp
+//  uscc
+//
+//  Implements dominator-based global value numbering --
+//  The dominator tree is walked in pre-order with a scoped
+//  hash table of the expressions computed so far. If an
+//  instruction computes the same expression as one that
+//  dominates it, it's replaced with the earlier value.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/ADT/Statistic.h>
+#pragma clang diagnostic pop
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "uscc-gvn"
+
+STATISTIC(NumGVNRemoved, "Number of redundant instructions removed");
+
+namespace uscc
+{
+namespace opt
+{
+
+namespace
+{
+
+// The expression an instruction computes. Since duplicates are
+// replaced as soon as they're found, each operand Value* is
+// already the value number of that operand.
+struct Expression
+{
+	unsigned mOpcode;
+	unsigned mPredicate;
+	// Flags like nsw or inbounds
+	unsigned mFlags;
+	llvm::Type* mType;
+	std::vector<Value*> mOperands;
+	
+	bool operator==(const Expression& other) const
+	{
+		return mOpcode == other.mOpcode && mPredicate == other.mPredicate &&
+			mFlags == other.mFlags && mType == other.mType &&
+			mOperands == other.mOperands;
+	}
+};
+
+struct ExpressionHash
+{
+	size_t operator()(const Expression& expr) const
+	{
+		size_t hash = std::hash<unsigned>()(expr.mOpcode);
+		hash = hash * 31 + expr.mPredicate;
+		hash = hash * 31 + expr.mFlags;
+		hash = hash * 31 + std::hash<llvm::Type*>()(expr.mType);
+		for (Value* op : expr.mOperands)
+		{
+			hash = hash * 31 + std::hash<Value*>()(op);
+		}
+		return hash;
+	}
+};
+
+class ValueTable
+{
+public:
+	ValueTable()
+	: mNumRemoved(0)
+	{ }
+	
+	// Numbers the instructions in node's block, then its dominator
+	// tree children. Whatever this block adds to the table is
+	// removed again once its subtree is done.
+	void numberPreOrder(DomTreeNode* node);
+	
+	unsigned getNumRemoved() const
+	{
+		return mNumRemoved;
+	}
+	
+private:
+	// Only instructions without side effects that read nothing
+	// but their operands can be numbered
+	static bool canNumber(Instruction* inst);
+	
+	static Expression makeExpression(Instruction* inst);
+	
+	std::unordered_map<Expression, Instruction*, ExpressionHash> mTable;
+	
+	unsigned mNumRemoved;
+};
+
+bool ValueTable::canNumber(Instruction* inst)
+{
+	return isa<BinaryOperator>(inst) || isa<CmpInst>(inst) ||
+		isa<CastInst>(inst) || isa<GetElementPtrInst>(inst);
+}
+
+Expression ValueTable::makeExpression(Instruction* inst)
+{
+	Expression expr;
+	expr.mOpcode = inst->getOpcode();
+	expr.mPredicate = 0;
+	expr.mFlags = inst->getRawSubclassOptionalData();
+	expr.mType = inst->getType();
+	for (Value* op : inst->operands())
+	{
+		expr.mOperands.push_back(op);
+	}
+	
+	// Put the operands of commutative ops in a fixed order,
+	// so that a + b and b + a get the same number
+	if (inst->isCommutative() && expr.mOperands[1] < expr.mOperands[0])
+	{
+		std::swap(expr.mOperands[0], expr.mOperands[1]);
+	}
+	
+	// Likewise, a > b is the same as b < a
+	if (CmpInst* cmp = dyn_cast<CmpInst>(inst))
+	{
+		CmpInst::Predicate pred = cmp->getPredicate();
+		if (expr.mOperands[1] < expr.mOperands[0])
+		{
+			std::swap(expr.mOperands[0], expr.mOperands[1]);
+			pred = CmpInst::getSwappedPredicate(pred);
+		}
+		expr.mPredicate = pred;
+	}
+	
+	return expr;
+}
+
+void ValueTable::numberPreOrder(DomTreeNode* node)
+{
+	std::vector<Expression> added;
+	
+	BasicBlock* block = node->getBlock();
+	BasicBlock::iterator instrIter = block->begin();
+	while (instrIter != block->end())
+	{
+		Instruction* inst = &*instrIter;
+		++instrIter;
+		
+		if (!canNumber(inst))
+		{
+			continue;
+		}
+		
+		Expression expr = makeExpression(inst);
+		auto found = mTable.find(expr);
+		if (found != mTable.end())
+		{
+			// An equivalent value dominates this one
+			inst->replaceAllUsesWith(found->second);
+			inst->eraseFromParent();
+			mNumRemoved++;
+		}
+		else
+		{
+			mTable.emplace(expr, inst);
+			added.push_back(std::move(expr));
+		}
+	}
+	
+	for (DomTreeNode* child : node->getChildren())
+	{
+		numberPreOrder(child);
+	}
+	
+	// These expressions don't dominate the rest of the function
+	for (const Expression& expr : added)
+	{
+		mTable.erase(expr);
+	}
+}
+
+} // anonymous namespace
+
+bool GVN::runOnFunction(Function& F)
+{
+	DominatorTree& domTree = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+	
+	ValueTable table;
+	table.numberPreOrder(domTree.getRootNode());
+	NumGVNRemoved += table.getNumRemoved();
+	
+	return table.getNumRemoved() > 0;
+}
+
+void GVN::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// GVN does not modify the CFG
+	Info.setPreservesCFG();
+	// Execute after dead blocks have been removed
+	Info.addRequired<DeadBlocks>();
+	Info.addRequired<DominatorTreeWrapperPass>();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::GVN::ID = 0;
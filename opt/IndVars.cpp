@@ -0,0 +1,290 @@
+//
+//  IndVars.cpp
+//  uscc
+//
+//  Implements induction variable simplification and loop
+//  strength reduction --
+//  A basic induction variable is a header phi that's increased
+//  by a constant every iteration (like i in a while loop with
+//  ++i). Multiplying one by a loop invariant value gives a
+//  derived induction variable, which is replaced with its own
+//  phi that's increased by the scaled step. Array accesses
+//  indexed by an induction variable become a pointer that's
+//  incremented, instead of a GEP from the base every iteration.
+//  Induction variables that end up unused are removed.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Transforms/Scalar.h>
+#include <llvm/ADT/Statistic.h>
+#pragma clang diagnostic pop
+#include <vector>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "uscc-indvars"
+
+STATISTIC(NumMulsReduced, "Number of multiplies replaced by an induction variable");
+STATISTIC(NumGEPsReduced, "Number of GEPs replaced by a pointer induction variable");
+STATISTIC(NumIVsRemoved, "Number of induction variables removed");
+
+namespace uscc
+{
+namespace opt
+{
+
+namespace
+{
+
+// Each pointer recurrence takes up a register for the whole loop,
+// and USC code is often compiled with very few registers
+const unsigned MAX_POINTER_IVS = 2;
+
+} // anonymous namespace
+
+bool IndVars::findBasicIVs()
+{
+	BasicBlock* header = mCurrLoop->getHeader();
+	for (auto inst = header->begin(); isa<PHINode>(inst); ++inst)
+	{
+		PHINode* phi = cast<PHINode>(inst);
+		if (!phi->getType()->isIntegerTy() || phi->getNumIncomingValues() != 2)
+		{
+			continue;
+		}
+		
+		// The next value has to be phi plus (or minus) a constant.
+		// Constant folding and GVN can put an add's operands either way.
+		BinaryOperator* next = dyn_cast<BinaryOperator>(
+			phi->getIncomingValueForBlock(mLatch));
+		if (next == nullptr)
+		{
+			continue;
+		}
+		
+		Value* stepVal = nullptr;
+		if (next->getOperand(0) == phi)
+		{
+			stepVal = next->getOperand(1);
+		}
+		else if (next->getOpcode() == Instruction::Add && next->getOperand(1) == phi)
+		{
+			stepVal = next->getOperand(0);
+		}
+		
+		ConstantInt* step = dyn_cast_or_null<ConstantInt>(stepVal);
+		if (step == nullptr)
+		{
+			continue;
+		}
+		
+		if (next->getOpcode() == Instruction::Sub)
+		{
+			step = cast<ConstantInt>(ConstantExpr::getNeg(step));
+		}
+		else if (next->getOpcode() != Instruction::Add)
+		{
+			continue;
+		}
+		
+		mIVs.push_back(InductionVar{phi, phi->getIncomingValueForBlock(mPreheader), step});
+	}
+	
+	return !mIVs.empty();
+}
+
+IndVars::InductionVar* IndVars::getIV(Value* val)
+{
+	for (InductionVar& iv : mIVs)
+	{
+		if (iv.mPhi == val)
+		{
+			return &iv;
+		}
+	}
+	
+	return nullptr;
+}
+
+PHINode* IndVars::createRecurrence(Value* start, Value* step, const Twine& name)
+{
+	BasicBlock* header = mCurrLoop->getHeader();
+	PHINode* phi = PHINode::Create(start->getType(), 2, name, header->begin());
+	
+	// The step is added at the end of the iteration, just
+	// like the increment of the basic induction variable
+	Instruction* next = nullptr;
+	if (phi->getType()->isPointerTy())
+	{
+		next = GetElementPtrInst::Create(phi, step, name + ".next", mLatch->getTerminator());
+	}
+	else
+	{
+		next = BinaryOperator::CreateAdd(phi, step, name + ".next", mLatch->getTerminator());
+	}
+	
+	phi->addIncoming(start, mPreheader);
+	phi->addIncoming(next, mLatch);
+	return phi;
+}
+
+Value* IndVars::createPreheaderMul(Value* lhs, Value* rhs, const Twine& name)
+{
+	Constant* constLHS = dyn_cast<Constant>(lhs);
+	Constant* constRHS = dyn_cast<Constant>(rhs);
+	if (constLHS != nullptr && constRHS != nullptr)
+	{
+		return ConstantExpr::getMul(constLHS, constRHS);
+	}
+	
+	return BinaryOperator::CreateMul(lhs, rhs, name, mPreheader->getTerminator());
+}
+
+void IndVars::reduceMultiply(BinaryOperator* mul)
+{
+	Value* op0 = mul->getOperand(0);
+	Value* op1 = mul->getOperand(1);
+	InductionVar* iv = getIV(op0);
+	Value* scale = op1;
+	if (iv == nullptr)
+	{
+		iv = getIV(op1);
+		scale = op0;
+	}
+	if (iv == nullptr || !mCurrLoop->isLoopInvariant(scale))
+	{
+		return;
+	}
+	
+	// i * k starts at start * k, and increases by step * k
+	Value* start = createPreheaderMul(iv->mStart, scale, "iv.start");
+	Value* step = createPreheaderMul(iv->mStep, scale, "iv.step");
+	
+	PHINode* phi = createRecurrence(start, step, mul->getName() + ".iv");
+	mul->replaceAllUsesWith(phi);
+	mul->eraseFromParent();
+	
+	// The new phi can be reduced further, like in a GEP
+	mIVs.push_back(InductionVar{phi, start, step});
+	NumMulsReduced++;
+	mChanged = true;
+}
+
+void IndVars::reduceGEP(GetElementPtrInst* gep)
+{
+	if (mNumPointerIVs >= MAX_POINTER_IVS || gep->getNumIndices() != 1 ||
+		!mCurrLoop->isLoopInvariant(gep->getPointerOperand()))
+	{
+		return;
+	}
+	
+	InductionVar* iv = getIV(gep->getOperand(1));
+	if (iv == nullptr)
+	{
+		return;
+	}
+	
+	// The pointer starts at &base[start], and moves step elements
+	GetElementPtrInst* start = GetElementPtrInst::Create(gep->getPointerOperand(), iv->mStart,
+														 "iv.start", mPreheader->getTerminator());
+	PHINode* phi = createRecurrence(start, iv->mStep, gep->getName() + ".iv");
+	gep->replaceAllUsesWith(phi);
+	gep->eraseFromParent();
+	mNumPointerIVs++;
+	NumGEPsReduced++;
+	mChanged = true;
+}
+
+void IndVars::removeDeadIVs()
+{
+	for (InductionVar& iv : mIVs)
+	{
+		// The only thing left using the phi is its own increment
+		Instruction* next = cast<Instruction>(iv.mPhi->getIncomingValueForBlock(mLatch));
+		if (iv.mPhi->hasOneUse() && next->hasOneUse() &&
+			*iv.mPhi->user_begin() == next && *next->user_begin() == iv.mPhi)
+		{
+			iv.mPhi->dropAllReferences();
+			next->eraseFromParent();
+			iv.mPhi->eraseFromParent();
+			NumIVsRemoved++;
+			mChanged = true;
+		}
+	}
+}
+
+bool IndVars::runOnLoop(Loop* L, LPPassManager& LPM)
+{
+	mChanged = false;
+	mCurrLoop = L;
+	mPreheader = L->getLoopPreheader();
+	mLatch = L->getLoopLatch();
+	mIVs.clear();
+	mNumPointerIVs = 0;
+	
+	if (mPreheader == nullptr || mLatch == nullptr || !findBasicIVs())
+	{
+		return false;
+	}
+	
+	// Multiplications first, so the GEPs can use the derived
+	// induction variables as well
+	std::vector<BinaryOperator*> muls;
+	std::vector<GetElementPtrInst*> geps;
+	for (BasicBlock* block : L->getBlocks())
+	{
+		for (Instruction& inst : *block)
+		{
+			BinaryOperator* binOp = dyn_cast<BinaryOperator>(&inst);
+			if (binOp != nullptr && binOp->getOpcode() == Instruction::Mul)
+			{
+				muls.push_back(binOp);
+			}
+			else if (GetElementPtrInst* gep = dyn_cast<GetElementPtrInst>(&inst))
+			{
+				geps.push_back(gep);
+			}
+		}
+	}
+	
+	for (BinaryOperator* mul : muls)
+	{
+		reduceMultiply(mul);
+	}
+	
+	for (GetElementPtrInst* gep : geps)
+	{
+		reduceGEP(gep);
+	}
+	
+	removeDeadIVs();
+	
+	return mChanged;
+}
+
+void IndVars::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// Only instructions are added, so the CFG stays the same
+	Info.setPreservesCFG();
+	Info.addRequired<DominatorTreeWrapperPass>();
+	Info.addRequired<LoopInfo>();
+	// A preheader and a single latch are needed to add recurrences
+	Info.addRequiredID(LoopSimplifyID);
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::IndVars::ID = 0;
@@ -0,0 +1,193 @@
+//
+//  Inliner.cpp
+//  uscc
+//
+//  Implements function inlining --
+//  Functions are visited bottom-up in the call graph, so a
+//  callee's own calls are inlined before it's considered for
+//  inlining into its callers. Each call site is inlined if
+//  the callee's size, minus the bonuses for that call site,
+//  fits under the threshold and the module's growth budget.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#pragma clang diagnostic pop
+#include <unordered_set>
+#include <algorithm>
+#include <vector>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+namespace
+{
+
+// A call site is inlined if the callee's cost is at most this
+const int INLINE_THRESHOLD = 40;
+
+// Removing the call saves roughly this much per argument, plus one
+const int CALL_SAVINGS = 1;
+
+// A constant argument will likely fold away some of the callee
+const int CONST_ARG_BONUS = 10;
+
+// Calls in loops are worth more, for each level of nesting
+const int LOOP_DEPTH_BONUS = 20;
+const unsigned MAX_LOOP_DEPTH = 3;
+
+// The module can grow by at most this percentage of its
+// original size (but always by at least MIN_GROWTH instructions)
+const size_t GROWTH_PERCENT = 50;
+const size_t MIN_GROWTH = 100;
+
+struct InlineSite
+{
+	CallInst* mCall;
+	unsigned mLoopDepth;
+};
+
+size_t countInstructions(const Function& F)
+{
+	size_t count = 0;
+	for (const BasicBlock& block : F)
+	{
+		count += block.size();
+	}
+	return count;
+}
+
+} // anonymous namespace
+
+int Inliner::getInlineCost(CallInst* call, unsigned loopDepth)
+{
+	Function* callee = call->getCalledFunction();
+	int cost = static_cast<int>(countInstructions(*callee));
+	cost -= CALL_SAVINGS * static_cast<int>(call->getNumArgOperands() + 1);
+	
+	unsigned argNum = 0;
+	for (Argument& arg : callee->getArgumentList())
+	{
+		if (isa<Constant>(call->getArgOperand(argNum)) && !arg.use_empty())
+		{
+			cost -= CONST_ARG_BONUS;
+		}
+		argNum++;
+	}
+	
+	cost -= LOOP_DEPTH_BONUS * static_cast<int>(std::min(loopDepth, MAX_LOOP_DEPTH));
+	
+	return cost;
+}
+
+bool Inliner::runOnModule(Module& M)
+{
+	// Order the functions bottom-up. A function that's part of a
+	// cycle in the call graph is never inlined, so that inlining
+	// always terminates.
+	CallGraph& callGraph = getAnalysis<CallGraphWrapperPass>().getCallGraph();
+	std::vector<Function*> order;
+	std::unordered_set<Function*> recursive;
+	for (auto scc = scc_begin(&callGraph); !scc.isAtEnd(); ++scc)
+	{
+		for (CallGraphNode* node : *scc)
+		{
+			Function* func = node->getFunction();
+			if (func != nullptr && !func->isDeclaration())
+			{
+				order.push_back(func);
+				if (scc.hasLoop())
+				{
+					recursive.insert(func);
+				}
+			}
+		}
+	}
+	
+	size_t moduleSize = 0;
+	for (Function& func : M)
+	{
+		moduleSize += countInstructions(func);
+	}
+	size_t budget = std::max(moduleSize * GROWTH_PERCENT / 100, MIN_GROWTH);
+	size_t growth = 0;
+	
+	bool changed = false;
+	for (Function* caller : order)
+	{
+		// Find the call sites up front, since inlining changes the
+		// caller's blocks (and invalidates its loop info)
+		LoopInfo& loopInfo = getAnalysis<LoopInfo>(*caller);
+		std::vector<InlineSite> callSites;
+		for (BasicBlock& block : *caller)
+		{
+			for (Instruction& inst : block)
+			{
+				CallInst* call = dyn_cast<CallInst>(&inst);
+				if (call == nullptr)
+				{
+					continue;
+				}
+				
+				Function* callee = call->getCalledFunction();
+				if (callee == nullptr || callee->isDeclaration() || callee->isVarArg() ||
+					recursive.count(callee) != 0)
+				{
+					continue;
+				}
+				
+				callSites.push_back(InlineSite{call, loopInfo.getLoopDepth(&block)});
+			}
+		}
+		
+		for (const InlineSite& site : callSites)
+		{
+			Function* callee = site.mCall->getCalledFunction();
+			size_t calleeSize = countInstructions(*callee);
+			if (getInlineCost(site.mCall, site.mLoopDepth) > INLINE_THRESHOLD ||
+				growth + calleeSize > budget)
+			{
+				continue;
+			}
+			
+			InlineFunctionInfo info;
+			if (InlineFunction(site.mCall, info))
+			{
+				growth += calleeSize;
+				changed = true;
+			}
+		}
+	}
+	
+	return changed;
+}
+
+void Inliner::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	Info.addRequired<CallGraphWrapperPass>();
+	Info.addRequired<LoopInfo>();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::Inliner::ID = 0;
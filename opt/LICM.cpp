@@ -18,7 +18,11 @@
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Dominators.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Operator.h>
 #include <llvm/Analysis/ValueTracking.h>
+#include <llvm/Transforms/Scalar.h>
 #pragma clang diagnostic pop
 
 using namespace llvm;
@@ -28,14 +32,158 @@ namespace uscc
 namespace opt
 {
     
+namespace
+{
+
+// Finds the arrays addr could point into, looking through phis and
+// selects. Returns false if any of them isn't a local, global, or
+// argument, since a pointer loaded from memory (or anything else)
+// could point anywhere.
+bool getIdentifiedObjects(Value* addr, SmallVectorImpl<Value*>& objects)
+{
+    GetUnderlyingObjects(addr, objects);
+    for (auto obj : objects) {
+        if (!isa<AllocaInst>(obj) && !isa<GlobalVariable>(obj) && !isa<Argument>(obj)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+} // anonymous namespace
+
+bool hasIdentifiedObjects(llvm::Value* addr)
+{
+    SmallVector<Value*, 4> objects;
+    return getIdentifiedObjects(addr, objects);
+}
+
+// Distinct locals or globals can't overlap, and neither can a local and
+// an argument, since the argument was created before the local was.
+// Within one array, different constant elements don't overlap either.
+bool mayAlias(llvm::Value* lhs, llvm::Value* rhs)
+{
+    GEPOperator* lhsGEP = dyn_cast<GEPOperator>(lhs);
+    GEPOperator* rhsGEP = dyn_cast<GEPOperator>(rhs);
+    if (lhsGEP != nullptr && rhsGEP != nullptr &&
+        lhsGEP->getPointerOperand() == rhsGEP->getPointerOperand() &&
+        lhsGEP->getNumOperands() == rhsGEP->getNumOperands()) {
+        // Only the last index may differ, so both point into the same
+        // (sub)array and can't overlap unless they're equal
+        unsigned last = lhsGEP->getNumOperands() - 1;
+        bool sameArray = true;
+        for (unsigned i = 1; i < last; i++) {
+            if (lhsGEP->getOperand(i) != rhsGEP->getOperand(i)) {
+                sameArray = false;
+            }
+        }
+        ConstantInt* lhsIdx = dyn_cast<ConstantInt>(lhsGEP->getOperand(last));
+        ConstantInt* rhsIdx = dyn_cast<ConstantInt>(rhsGEP->getOperand(last));
+        if (sameArray && lhsIdx != nullptr && rhsIdx != nullptr &&
+            lhsIdx->getSExtValue() != rhsIdx->getSExtValue()) {
+            return false;
+        }
+    }
+    
+    SmallVector<Value*, 4> lhsObjs;
+    SmallVector<Value*, 4> rhsObjs;
+    if (!getIdentifiedObjects(lhs, lhsObjs) || !getIdentifiedObjects(rhs, rhsObjs)) {
+        return true;
+    }
+    
+    for (auto lhsObj : lhsObjs) {
+        for (auto rhsObj : rhsObjs) {
+            // Two arguments, or an argument and a global, can be the same array
+            bool distinct = lhsObj != rhsObj &&
+                (isa<AllocaInst>(lhsObj) || isa<AllocaInst>(rhsObj) ||
+                 (isa<GlobalVariable>(lhsObj) && isa<GlobalVariable>(rhsObj)));
+            if (!distinct) {
+                return true;
+            }
+        }
+    }
+    
+    return false;
+}
+
 bool LICM::isSafeToHoistInstr(llvm::Instruction* inst){
-    return (mCurrLoop->hasLoopInvariantOperands(inst) &&
-            isSafeToSpeculativelyExecute(inst) && (
+    if (!mCurrLoop->hasLoopInvariantOperands(inst)) {
+        return false;
+    }
+    
+    if (LoadInst* load = dyn_cast<LoadInst>(inst)) {
+        return isInvariantLoad(load) &&
+            (isSafeToSpeculativelyExecute(inst) || isGuaranteedToExecute(inst));
+    }
+    
+    // Pure functions can't trap, so they're always safe to call
+    if (CallInst* call = dyn_cast<CallInst>(inst)) {
+        Function* callee = call->getCalledFunction();
+        return callee != nullptr && callee->doesNotAccessMemory() &&
+            !isa<IntrinsicInst>(call);
+    }
+    
+    return (isSafeToSpeculativelyExecute(inst) && (
             isa<BinaryOperator>(inst) || isa<CastInst>(inst) || isa<SelectInst>(inst) ||
             isa<GetElementPtrInst>(inst) || isa<CmpInst>(inst))
             );
 }
 
+bool LICM::isInvariantLoad(llvm::LoadInst* load){
+    if (load->isVolatile() || mHasClobberingCall) {
+        return false;
+    }
+    
+    for (auto addr : mStoredAddrs) {
+        if (mayAlias(addr, load->getPointerOperand())) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool LICM::isGuaranteedToExecute(llvm::Instruction* inst){
+    // If the loop is entered, inst runs before the loop can exit
+    SmallVector<BasicBlock*, 4> exitingBlocks;
+    mCurrLoop->getExitingBlocks(exitingBlocks);
+    for (auto exiting : exitingBlocks) {
+        if (!mDomTree->dominates(inst->getParent(), exiting)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+void LICM::findLoopWrites(){
+    mStoredAddrs.clear();
+    mHasClobberingCall = false;
+    
+    // This includes the blocks of any nested loops
+    for (auto block : mCurrLoop->getBlocks()) {
+        for (auto& inst : *block) {
+            if (StoreInst* store = dyn_cast<StoreInst>(&inst)) {
+                mStoredAddrs.push_back(store->getPointerOperand());
+            } else if (IntrinsicInst* intrinsic = dyn_cast<IntrinsicInst>(&inst)) {
+                // The end of an array's lifetime clobbers it
+                if (intrinsic->getIntrinsicID() == Intrinsic::lifetime_start ||
+                    intrinsic->getIntrinsicID() == Intrinsic::lifetime_end) {
+                    mStoredAddrs.push_back(intrinsic->getArgOperand(1));
+                } else {
+                    mHasClobberingCall = true;
+                }
+            } else if (CallInst* call = dyn_cast<CallInst>(&inst)) {
+                Function* callee = call->getCalledFunction();
+                if (callee == nullptr || !callee->onlyReadsMemory()) {
+                    mHasClobberingCall = true;
+                }
+            }
+        }
+    }
+}
+
 void LICM::hoistInstr(llvm::Instruction* inst){
     auto preheaderBlock = mCurrLoop->getLoopPreheader();
     auto terminator = preheaderBlock->getTerminator();
@@ -45,6 +193,10 @@ void LICM::hoistInstr(llvm::Instruction* inst){
 
 void LICM::hoistPreOrder(llvm::DomTreeNode *node){
     auto block = node->getBlock();
+    // Nothing dominated by a block outside the loop is in the loop
+    if (!mCurrLoop->contains(block)) {
+        return;
+    }
     if (mLoopInfo->getLoopFor(block) == mCurrLoop){
         for (auto it = block->begin(); it != block->end(); ) {
             auto currInst = it;
@@ -71,7 +223,11 @@ bool LICM::runOnLoop(llvm::Loop *L, llvm::LPPassManager &LPM)
     // Grab the dominator tree
     mDomTree = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
     
-    auto node = mDomTree->getRootNode();
+    // Find what memory the loop might write, for hoisting loads
+    findLoopWrites();
+    
+    // Only the header's subtree can contain blocks of the loop
+    auto node = mDomTree->getNode(L->getHeader());
     hoistPreOrder(node);
 
 	return mChanged;
@@ -82,8 +238,10 @@ void LICM::getAnalysisUsage(AnalysisUsage &Info) const
 	// PA5: Implement
     // LICM does not modify the CFG
     Info.setPreservesCFG();
-    // Execute after dead blocks have been removed
-    Info.addRequired<DeadBlocks>();
+    // Execute after the other passes have cleaned up the function
+    Info.addRequired<TailRecursion>();
+    // Merged blocks can leave loops without a preheader to hoist into
+    Info.addRequiredID(LoopSimplifyID);
     // Use the built-in Dominator tree and loop info passes
     Info.addRequired<DominatorTreeWrapperPass>();
     Info.addRequired<LoopInfo>();
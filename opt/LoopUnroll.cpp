@@ -0,0 +1,380 @@
+//
+//  LoopUnroll.cpp
+//  uscc
+//
+//  Implements loop unrolling for loops with a constant trip
+//  count. The trip count is found by evaluating the loop test
+//  for each value of a header phi that starts at a constant.
+//  Small loops are unrolled completely. Larger ones have
+//  their body copied a few times, after the leftover
+//  iterations have been peeled off in front of the loop.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#pragma clang diagnostic pop
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+namespace
+{
+
+// Loops that run more often than this aren't evaluated any further
+const unsigned MAX_TRIP_COUNT = 1024;
+
+// Partial unrolling tries these factors, largest first
+const unsigned UNROLL_FACTORS[] = { 8, 4, 2 };
+
+// Computes val with the induction variable iv set to ivVal.
+// Returns nullptr if val depends on anything else in the loop.
+Constant* evaluate(Value* val, PHINode* iv, Constant* ivVal, Loop* loop)
+{
+	if (val == iv)
+	{
+		return ivVal;
+	}
+	
+	if (Constant* c = dyn_cast<Constant>(val))
+	{
+		return c;
+	}
+	
+	Instruction* inst = dyn_cast<Instruction>(val);
+	if (inst == nullptr || !loop->contains(inst->getParent()))
+	{
+		return nullptr;
+	}
+	
+	if (BinaryOperator* binOp = dyn_cast<BinaryOperator>(inst))
+	{
+		Constant* lhs = evaluate(binOp->getOperand(0), iv, ivVal, loop);
+		Constant* rhs = evaluate(binOp->getOperand(1), iv, ivVal, loop);
+		if (lhs != nullptr && rhs != nullptr)
+		{
+			return ConstantExpr::get(binOp->getOpcode(), lhs, rhs);
+		}
+	}
+	else if (CmpInst* cmp = dyn_cast<CmpInst>(inst))
+	{
+		Constant* lhs = evaluate(cmp->getOperand(0), iv, ivVal, loop);
+		Constant* rhs = evaluate(cmp->getOperand(1), iv, ivVal, loop);
+		if (lhs != nullptr && rhs != nullptr)
+		{
+			return ConstantExpr::getCompare(cmp->getPredicate(), lhs, rhs);
+		}
+	}
+	else if (CastInst* cast = dyn_cast<CastInst>(inst))
+	{
+		Constant* op = evaluate(cast->getOperand(0), iv, ivVal, loop);
+		if (op != nullptr)
+		{
+			return ConstantExpr::getCast(cast->getOpcode(), op, cast->getType());
+		}
+	}
+	
+	return nullptr;
+}
+
+} // anonymous namespace
+
+bool LoopUnroll::getTripCount(unsigned& tripCount)
+{
+	BranchInst* br = cast<BranchInst>(mHeader->getTerminator());
+	for (auto inst = mHeader->begin(); isa<PHINode>(inst); ++inst)
+	{
+		PHINode* phi = cast<PHINode>(inst);
+		Constant* ivVal = dyn_cast<ConstantInt>(phi->getIncomingValueForBlock(mPreheader));
+		Value* next = phi->getIncomingValueForBlock(mLatch);
+		
+		// Run the loop test until it leaves the loop
+		unsigned count = 0;
+		while (ivVal != nullptr && count <= MAX_TRIP_COUNT)
+		{
+			ConstantInt* cond = dyn_cast_or_null<ConstantInt>(
+				evaluate(br->getCondition(), phi, ivVal, mCurrLoop));
+			if (cond == nullptr)
+			{
+				break;
+			}
+			
+			BasicBlock* succ = br->getSuccessor(cond->isOne() ? 0 : 1);
+			if (!mCurrLoop->contains(succ))
+			{
+				tripCount = count;
+				return true;
+			}
+			
+			ivVal = dyn_cast_or_null<ConstantInt>(evaluate(next, phi, ivVal, mCurrLoop));
+			count++;
+		}
+	}
+	
+	return false;
+}
+
+void LoopUnroll::cloneIteration(std::vector<Value*>& headerVals, bool inLoop,
+								BasicBlock*& first, BasicBlock*& last)
+{
+	ValueToValueMapTy vmap;
+	std::vector<BasicBlock*> clones;
+	Loop* parent = mCurrLoop->getParentLoop();
+	for (BasicBlock* block : mBlocks)
+	{
+		BasicBlock* clone = CloneBasicBlock(block, vmap, inLoop ? ".unroll" : ".peel",
+											mHeader->getParent());
+		clone->moveBefore(mHeader);
+		vmap[block] = clone;
+		clones.push_back(clone);
+		
+		if (inLoop)
+		{
+			mCurrLoop->addBasicBlockToLoop(clone, mLoopInfo->getBase());
+		}
+		else if (parent != nullptr)
+		{
+			parent->addBasicBlockToLoop(clone, mLoopInfo->getBase());
+		}
+	}
+	
+	// The copy's header phis are just the values coming in
+	unsigned i = 0;
+	for (auto inst = mHeader->begin(); isa<PHINode>(inst); ++inst)
+	{
+		PHINode* phi = cast<PHINode>(inst);
+		PHINode* clonePhi = cast<PHINode>(vmap[phi]);
+		vmap[phi] = headerVals[i++];
+		clonePhi->eraseFromParent();
+	}
+	
+	for (BasicBlock* clone : clones)
+	{
+		for (Instruction& inst : *clone)
+		{
+			RemapInstruction(&inst, vmap, RF_IgnoreMissingEntries);
+		}
+	}
+	
+	// The copy's loop test is known to stay in the loop
+	BranchInst* br = cast<BranchInst>(mHeader->getTerminator());
+	unsigned stay = mCurrLoop->contains(br->getSuccessor(0)) ? 0 : 1;
+	first = cast<BasicBlock>(vmap[mHeader]);
+	BranchInst* cloneBr = cast<BranchInst>(first->getTerminator());
+	BranchInst::Create(cloneBr->getSuccessor(stay), cloneBr);
+	cloneBr->eraseFromParent();
+	last = cast<BasicBlock>(vmap[mLatch]);
+	
+	// Find the values the header phis have after this iteration
+	i = 0;
+	for (auto inst = mHeader->begin(); isa<PHINode>(inst); ++inst)
+	{
+		Value* next = cast<PHINode>(inst)->getIncomingValueForBlock(mLatch);
+		auto mapped = vmap.find(next);
+		if (mapped != vmap.end())
+		{
+			next = mapped->second;
+		}
+		headerVals[i++] = next;
+	}
+}
+
+void LoopUnroll::peelIterations(unsigned count)
+{
+	std::vector<Value*> headerVals;
+	for (auto inst = mHeader->begin(); isa<PHINode>(inst); ++inst)
+	{
+		headerVals.push_back(cast<PHINode>(inst)->getIncomingValueForBlock(mPreheader));
+	}
+	
+	// Each copy goes between the block before it and the header
+	BasicBlock* pred = mPreheader;
+	for (unsigned k = 0; k < count; k++)
+	{
+		BasicBlock* first = nullptr;
+		BasicBlock* last = nullptr;
+		cloneIteration(headerVals, false, first, last);
+		pred->getTerminator()->replaceUsesOfWith(mHeader, first);
+		last->getTerminator()->setSuccessor(0, mHeader);
+		pred = last;
+	}
+	
+	unsigned i = 0;
+	for (auto inst = mHeader->begin(); isa<PHINode>(inst); ++inst)
+	{
+		PHINode* phi = cast<PHINode>(inst);
+		int idx = phi->getBasicBlockIndex(mPreheader);
+		phi->setIncomingBlock(idx, pred);
+		phi->setIncomingValue(idx, headerVals[i++]);
+	}
+	
+	mPreheader = pred;
+}
+
+void LoopUnroll::unrollBody(unsigned factor)
+{
+	std::vector<Value*> headerVals;
+	for (auto inst = mHeader->begin(); isa<PHINode>(inst); ++inst)
+	{
+		headerVals.push_back(cast<PHINode>(inst)->getIncomingValueForBlock(mLatch));
+	}
+	
+	// Each copy goes between the previous latch and the header
+	BasicBlock* prevLatch = mLatch;
+	for (unsigned k = 1; k < factor; k++)
+	{
+		BasicBlock* first = nullptr;
+		BasicBlock* last = nullptr;
+		cloneIteration(headerVals, true, first, last);
+		prevLatch->getTerminator()->setSuccessor(0, first);
+		last->getTerminator()->setSuccessor(0, mHeader);
+		prevLatch = last;
+	}
+	
+	unsigned i = 0;
+	for (auto inst = mHeader->begin(); isa<PHINode>(inst); ++inst)
+	{
+		PHINode* phi = cast<PHINode>(inst);
+		int idx = phi->getBasicBlockIndex(mLatch);
+		phi->setIncomingBlock(idx, prevLatch);
+		phi->setIncomingValue(idx, headerVals[i++]);
+	}
+	
+	mLatch = prevLatch;
+}
+
+void LoopUnroll::removeLoop(LPPassManager& LPM)
+{
+	// Every iteration has been peeled, so the test always exits
+	BranchInst* br = cast<BranchInst>(mHeader->getTerminator());
+	unsigned stay = mCurrLoop->contains(br->getSuccessor(0)) ? 0 : 1;
+	BasicBlock* body = br->getSuccessor(stay);
+	BranchInst::Create(br->getSuccessor(1 - stay), br);
+	body->removePredecessor(mHeader);
+	br->eraseFromParent();
+	mHeader->removePredecessor(mLatch);
+	
+	// The rest of the loop is unreachable now
+	for (BasicBlock* block : mBlocks)
+	{
+		if (block != mHeader)
+		{
+			mLoopInfo->removeBlock(block);
+			block->dropAllReferences();
+		}
+	}
+	
+	for (BasicBlock* block : mBlocks)
+	{
+		if (block != mHeader)
+		{
+			block->eraseFromParent();
+		}
+	}
+	
+	LPM.deleteLoopFromQueue(mCurrLoop);
+}
+
+bool LoopUnroll::runOnLoop(Loop* L, LPPassManager& LPM)
+{
+	mCurrLoop = L;
+	mLoopInfo = &getAnalysis<LoopInfo>();
+	mDomTree = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+	mPreheader = L->getLoopPreheader();
+	mHeader = L->getHeader();
+	mLatch = L->getLoopLatch();
+	
+	// Only innermost loops shaped like a USC while loop: the header
+	// has the test, and the latch just branches back to it
+	if (mBudget == 0 || !L->empty() || mPreheader == nullptr || mLatch == nullptr ||
+		mLatch == mHeader || L->getExitingBlock() != mHeader)
+	{
+		return false;
+	}
+	
+	BranchInst* headerBr = dyn_cast<BranchInst>(mHeader->getTerminator());
+	BranchInst* latchBr = dyn_cast<BranchInst>(mLatch->getTerminator());
+	if (headerBr == nullptr || !headerBr->isConditional() ||
+		latchBr == nullptr || latchBr->isConditional())
+	{
+		return false;
+	}
+	
+	unsigned tripCount = 0;
+	if (!getTripCount(tripCount))
+	{
+		return false;
+	}
+	
+	mBlocks.assign(L->block_begin(), L->block_end());
+	unsigned loopSize = 0;
+	for (BasicBlock* block : mBlocks)
+	{
+		loopSize += static_cast<unsigned>(block->size());
+	}
+	
+	if (tripCount * loopSize <= mBudget)
+	{
+		peelIterations(tripCount);
+		removeLoop(LPM);
+	}
+	else
+	{
+		// The leftover iterations are peeled first, so the
+		// copies of the body don't need their own tests
+		unsigned factor = 0;
+		for (unsigned f : UNROLL_FACTORS)
+		{
+			if (tripCount >= 2 * f && (f + tripCount % f) * loopSize <= mBudget)
+			{
+				factor = f;
+				break;
+			}
+		}
+		
+		if (factor == 0)
+		{
+			return false;
+		}
+		
+		peelIterations(tripCount % factor);
+		unrollBody(factor);
+	}
+	
+	mDomTree->recalculate(*mHeader->getParent());
+	return true;
+}
+
+void LoopUnroll::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	Info.addRequired<DominatorTreeWrapperPass>();
+	Info.addRequired<LoopInfo>();
+	Info.addRequiredID(LoopSimplifyID);
+	// The dominator tree and loop info are kept up to date,
+	// so the rest of the loop passes can still use them
+	Info.addPreserved<DominatorTreeWrapperPass>();
+	Info.addPreserved<LoopInfo>();
+	Info.addPreservedID(LoopSimplifyID);
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::LoopUnroll::ID = 0;
@@ -16,7 +16,9 @@
 #include "Passes.h"
 #include <llvm/IR/Dominators.h>
 #include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/CallGraph.h>
 #include <llvm/PassRegistry.h>
+#include <llvm/InitializePasses.h>
 
 using namespace llvm;
 
@@ -25,15 +27,34 @@ namespace uscc
 namespace opt
 {
 
-void registerOptPasses(legacy::PassManager& pm)
+void registerModulePasses(legacy::PassManager& pm)
 {
 	PassRegistry& pr = *PassRegistry::getPassRegistry();
+	initializeCallGraphWrapperPassPass(pr);
 	initializeLoopInfoPass(pr);
 	initializeDominatorTreeWrapperPassPass(pr);
+	pm.add(new Inliner());
+	pm.add(new PureFunctions());
+}
+
+void registerOptPasses(legacy::PassManager& pm, unsigned unrollBudget)
+{
+	PassRegistry& pr = *PassRegistry::getPassRegistry();
+	initializeLoopInfoPass(pr);
+	initializeDominatorTreeWrapperPassPass(pr);
+	initializeLoopSimplifyPass(pr);
 	pm.add(new ConstantOps());
 	pm.add(new ConstantBranch());
+	pm.add(new SCCP());
 	pm.add(new DeadBlocks());
+	pm.add(new GVN());
+	pm.add(new ADCE());
+	pm.add(new SimplifyCFG());
+	pm.add(new TailRecursion());
 	pm.add(new LICM());
+	pm.add(new ScalarPromotion());
+	pm.add(new IndVars());
+	pm.add(new LoopUnroll(unrollBudget));
 	pm.add(new DominatorTreeWrapperPass());
 	pm.add(new LoopInfo());
 }
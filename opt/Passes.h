@@ -4,11 +4,21 @@
 //
 //  Declares the opt passes supported by USCC
 //
-//  At the moment, there are four passes:
+//  At the moment, there are fourteen passes:
+//     * Function inlining
+//     * Marking functions without side effects as pure
 //     * Constant op removal
 //     * Constant branch folding
+//     * Sparse conditional constant propagation (SCCP)
 //     * Removal of dead blocks from CFG
+//     * Global value numbering (GVN)
+//     * Aggressive dead code elimination (ADCE)
+//     * CFG simplification
+//     * Tail recursion elimination
 //     * Loop Invariant Code Motion (LICM)
+//     * Scalar promotion of array elements in loops
+//     * Induction variable simplification and strength reduction
+//     * Loop unrolling
 //
 //  These passes will execute if uscc is ran with -O
 //
@@ -26,10 +36,13 @@
 #include <llvm/Analysis/LoopPass.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Dominators.h>
+#include <llvm/IR/Instructions.h>
 #pragma clang diagnostic pop
+#include <vector>
 
 using llvm::FunctionPass;
 using llvm::LoopPass;
+using llvm::ModulePass;
 
 namespace uscc
 {
@@ -37,8 +50,53 @@ namespace uscc
 namespace opt
 {
 
-// Helper function for registering the opt passes
-void registerOptPasses(llvm::legacy::PassManager& pm);
+// Helper function for registering the passes that work on
+// the whole module. These must run before registerOptPasses,
+// and can't be split up between threads.
+void registerModulePasses(llvm::legacy::PassManager& pm);
+
+// The most instructions an unrolled loop may have,
+// unless uscc is given another --unroll-budget
+const unsigned DEFAULT_UNROLL_BUDGET = 200;
+
+// Helper function for registering the opt passes.
+// unrollBudget is the most instructions an unrolled loop may have.
+void registerOptPasses(llvm::legacy::PassManager& pm, unsigned unrollBudget);
+
+// Whether two pointers could refer to the same memory
+// (implemented in LICM.cpp)
+bool mayAlias(llvm::Value* lhs, llvm::Value* rhs);
+
+// Whether every array addr could point into is known to be
+// a local, global, or argument (implemented in LICM.cpp)
+bool hasIdentifiedObjects(llvm::Value* addr);
+
+// Declares the Function Inlining Pass
+struct Inliner : public ModulePass
+{
+	static char ID;
+	Inliner() : ModulePass(ID) {}
+	
+	virtual bool runOnModule(llvm::Module& M) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+	
+	// Estimates how much inlining this call costs (lower is better),
+	// given how deeply nested in loops the call is
+	int getInlineCost(llvm::CallInst* call, unsigned loopDepth);
+};
+
+// Marks the functions that can be called without any effect
+// other than computing their return value
+struct PureFunctions : public ModulePass
+{
+	static char ID;
+	PureFunctions() : ModulePass(ID) {}
+	
+	virtual bool runOnModule(llvm::Module& M) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+};
 
 // Declares the Constant Propagation Pass
 struct ConstantOps : public FunctionPass
@@ -62,6 +120,17 @@ struct ConstantBranch : public FunctionPass
 	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
 };
 
+// Declares the Sparse Conditional Constant Propagation Pass
+struct SCCP : public FunctionPass
+{
+	static char ID;
+	SCCP() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+};
+
 // Declares the Dead Block Removal Pass
 struct DeadBlocks : public FunctionPass
 {
@@ -72,6 +141,50 @@ struct DeadBlocks : public FunctionPass
 	
 	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
 };
+
+// Declares the Global Value Numbering Pass
+struct GVN : public FunctionPass
+{
+	static char ID;
+	GVN() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+};
+
+// Declares the Aggressive Dead Code Elimination Pass
+struct ADCE : public FunctionPass
+{
+	static char ID;
+	ADCE() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+};
+
+// Declares the CFG Simplification Pass
+struct SimplifyCFG : public FunctionPass
+{
+	static char ID;
+	SimplifyCFG() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+};
+
+// Declares the Tail Recursion Elimination Pass
+struct TailRecursion : public FunctionPass
+{
+	static char ID;
+	TailRecursion() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+};
 	
 // Loop invariant code motion
 struct LICM : public LoopPass
@@ -88,9 +201,24 @@ struct LICM : public LoopPass
     void hoistInstr(llvm::Instruction* inst);
     
     void hoistPreOrder(llvm::DomTreeNode* node);
+    
+    // Whether nothing in the loop can write the memory this loads
+    bool isInvariantLoad(llvm::LoadInst* load);
+    
+    // Whether inst runs on every iteration that doesn't exit early
+    bool isGuaranteedToExecute(llvm::Instruction* inst);
+    
+    // Collects the stores and calls in the current loop
+    void findLoopWrites();
 
 	// Data regarding the current loop
 	llvm::Loop* mCurrLoop;
+	
+	// The addresses stored to in the current loop
+	std::vector<llvm::Value*> mStoredAddrs;
+	
+	// Whether the current loop calls something that might write memory
+	bool mHasClobberingCall;
 
 	// The dominator tree for this loop
 	llvm::DominatorTree* mDomTree;
@@ -101,6 +229,153 @@ struct LICM : public LoopPass
 	// Denotes whether or not loop has been modified
 	bool mChanged;
 };
+
+// Keeps array elements that are accessed at a loop invariant
+// address in registers for the duration of the loop
+struct ScalarPromotion : public LoopPass
+{
+	static char ID;
+	ScalarPromotion() : LoopPass(ID) {}
+	
+	virtual bool runOnLoop(llvm::Loop* L, llvm::LPPassManager& LPM) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+	
+	// The loads and stores of the loop at one address, in order
+	struct AddressAccesses
+	{
+		llvm::Value* mAddr;
+		llvm::Type* mType;
+		std::vector<llvm::Instruction*> mInsts;
+		bool mHasStore;
+		// False if any access is volatile or of a different type,
+		// or the address is clobbered by a lifetime marker
+		bool mPromotable;
+	};
+	
+	// Groups the memory accesses of the loop by address. Returns false
+	// if the loop calls something that might access memory.
+	bool findAccesses();
+	
+	// Whether the address can be kept in a register for the whole loop
+	bool canPromote(const AddressAccesses& accesses);
+	
+	// Replaces the accesses with a load before the loop, the values
+	// in registers, and stores after the loop
+	void promote(AddressAccesses& accesses);
+	
+	// Data regarding the current loop
+	llvm::Loop* mCurrLoop;
+	llvm::BasicBlock* mPreheader;
+	std::vector<AddressAccesses> mAddresses;
+	
+	// The dominator tree for this loop
+	llvm::DominatorTree* mDomTree;
+	
+	// Denotes whether or not loop has been modified
+	bool mChanged;
+};
+
+// Induction variable simplification and loop strength reduction
+struct IndVars : public LoopPass
+{
+	static char ID;
+	IndVars() : LoopPass(ID) {}
+	
+	virtual bool runOnLoop(llvm::Loop* L, llvm::LPPassManager& LPM) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+	
+	// A header phi that starts at mStart and increases by mStep
+	// (which is loop invariant) every iteration
+	struct InductionVar
+	{
+		llvm::PHINode* mPhi;
+		llvm::Value* mStart;
+		llvm::Value* mStep;
+	};
+	
+	// Finds the header phis that are increased by a constant
+	bool findBasicIVs();
+	
+	// Returns the induction variable for this phi, or nullptr
+	InductionVar* getIV(llvm::Value* val);
+	
+	// Creates a header phi that starts at start and is increased
+	// by step (or for pointers, moved by step elements) in the latch
+	llvm::PHINode* createRecurrence(llvm::Value* start, llvm::Value* step,
+									const llvm::Twine& name);
+	
+	// Multiplies two loop invariant values in the preheader
+	llvm::Value* createPreheaderMul(llvm::Value* lhs, llvm::Value* rhs,
+									const llvm::Twine& name);
+	
+	// Replaces iv * k with a new induction variable
+	void reduceMultiply(llvm::BinaryOperator* mul);
+	
+	// Replaces &base[iv] with a pointer that's incremented
+	void reduceGEP(llvm::GetElementPtrInst* gep);
+	
+	// Removes induction variables only used by their own increment
+	void removeDeadIVs();
+	
+	// Data regarding the current loop
+	llvm::Loop* mCurrLoop;
+	llvm::BasicBlock* mPreheader;
+	llvm::BasicBlock* mLatch;
+	
+	// Induction variables found (or created) in this loop
+	std::vector<InductionVar> mIVs;
+	
+	// Number of pointer induction variables created in this loop
+	unsigned mNumPointerIVs;
+	
+	// Denotes whether or not loop has been modified
+	bool mChanged;
+};
+
+// Unrolls loops with a constant trip count
+struct LoopUnroll : public LoopPass
+{
+	static char ID;
+	LoopUnroll(unsigned budget = 0) : LoopPass(ID), mBudget(budget) {}
+	
+	virtual bool runOnLoop(llvm::Loop* L, llvm::LPPassManager& LPM) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+	
+	// Finds how many times the loop body runs, if it's a constant
+	bool getTripCount(unsigned& tripCount);
+	
+	// Copies the loop's blocks as an iteration that doesn't exit.
+	// headerVals are the values of the header phis going into the
+	// copy, and are updated to the values going out of it.
+	void cloneIteration(std::vector<llvm::Value*>& headerVals, bool inLoop,
+						llvm::BasicBlock*& first, llvm::BasicBlock*& last);
+	
+	// Runs count iterations before the loop is entered
+	void peelIterations(unsigned count);
+	
+	// Makes each trip around the loop run factor iterations
+	void unrollBody(unsigned factor);
+	
+	// Removes the loop once all of its iterations have been peeled
+	void removeLoop(llvm::LPPassManager& LPM);
+	
+	// The most instructions an unrolled loop may have
+	unsigned mBudget;
+	
+	// Data regarding the current loop
+	llvm::Loop* mCurrLoop;
+	llvm::BasicBlock* mPreheader;
+	llvm::BasicBlock* mHeader;
+	llvm::BasicBlock* mLatch;
+	std::vector<llvm::BasicBlock*> mBlocks;
+	
+	// The dominator tree and loop info, which are kept up to date
+	llvm::DominatorTree* mDomTree;
+	llvm::LoopInfo* mLoopInfo;
+};
 	
 } // opt
 } // uscc
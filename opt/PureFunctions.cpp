@@ -0,0 +1,177 @@
+//
+//  PureFunctions.cpp
+//  uscc
+//
+//  Finds the functions that only compute their return value.
+//  These are marked readnone, which LICM uses to hoist calls
+//  to them out of loops. Since a hoisted call may run when
+//  the loop wouldn't have, a function is only marked if it
+//  also can't trap or loop forever.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/ADT/SCCIterator.h>
+#pragma clang diagnostic pop
+#include <unordered_set>
+#include <vector>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+namespace
+{
+
+// Whether any block branches back to a block that's still being
+// visited in a depth-first search, which means there's a loop
+bool hasLoop(Function& F)
+{
+	std::unordered_set<BasicBlock*> visited;
+	std::unordered_set<BasicBlock*> onStack;
+	std::vector<std::pair<BasicBlock*, succ_iterator>> stack;
+	BasicBlock* entry = &F.getEntryBlock();
+	visited.insert(entry);
+	onStack.insert(entry);
+	stack.emplace_back(entry, succ_begin(entry));
+	while (!stack.empty())
+	{
+		BasicBlock* block = stack.back().first;
+		succ_iterator& succ = stack.back().second;
+		if (succ == succ_end(block))
+		{
+			onStack.erase(block);
+			stack.pop_back();
+			continue;
+		}
+		
+		BasicBlock* next = *succ;
+		++succ;
+		if (onStack.count(next) != 0)
+		{
+			return true;
+		}
+		if (visited.insert(next).second)
+		{
+			onStack.insert(next);
+			stack.emplace_back(next, succ_begin(next));
+		}
+	}
+	
+	return false;
+}
+
+bool isPure(Function& F)
+{
+	if (hasLoop(F))
+	{
+		return false;
+	}
+	
+	for (BasicBlock& block : F)
+	{
+		for (Instruction& inst : block)
+		{
+			if (isa<PHINode>(&inst) || isa<BranchInst>(&inst) ||
+				isa<ReturnInst>(&inst) || isa<AllocaInst>(&inst))
+			{
+				continue;
+			}
+			
+			if (IntrinsicInst* intrinsic = dyn_cast<IntrinsicInst>(&inst))
+			{
+				if (intrinsic->getIntrinsicID() == Intrinsic::lifetime_start ||
+					intrinsic->getIntrinsicID() == Intrinsic::lifetime_end)
+				{
+					continue;
+				}
+				return false;
+			}
+			
+			// Callees are visited first, so they've already been marked
+			if (CallInst* call = dyn_cast<CallInst>(&inst))
+			{
+				Function* callee = call->getCalledFunction();
+				if (callee == nullptr || !callee->doesNotAccessMemory())
+				{
+					return false;
+				}
+				continue;
+			}
+			
+			// Loads are only allowed from locals, and only if they
+			// can't go out of bounds
+			if (LoadInst* load = dyn_cast<LoadInst>(&inst))
+			{
+				if (!isa<AllocaInst>(GetUnderlyingObject(load->getPointerOperand())))
+				{
+					return false;
+				}
+			}
+			
+			// This rejects stores, as well as divisions that could trap
+			if (!isSafeToSpeculativelyExecute(&inst))
+			{
+				return false;
+			}
+		}
+	}
+	
+	return true;
+}
+
+} // anonymous namespace
+
+bool PureFunctions::runOnModule(Module& M)
+{
+	// Callees have to be visited before their callers. Functions
+	// in a cycle of calls might recurse forever, so they're skipped.
+	CallGraph& callGraph = getAnalysis<CallGraphWrapperPass>().getCallGraph();
+	bool changed = false;
+	for (auto scc = scc_begin(&callGraph); !scc.isAtEnd(); ++scc)
+	{
+		if (scc.hasLoop())
+		{
+			continue;
+		}
+		
+		Function* func = (*scc)[0]->getFunction();
+		if (func != nullptr && !func->isDeclaration() && isPure(*func))
+		{
+			func->setDoesNotAccessMemory();
+			func->setDoesNotThrow();
+			changed = true;
+		}
+	}
+	
+	return changed;
+}
+
+void PureFunctions::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// Only attributes are added
+	Info.setPreservesAll();
+	Info.addRequired<CallGraphWrapperPass>();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::PureFunctions::ID = 0;
@@ -44,6 +44,7 @@
 #undef DEBUG
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/raw_os_ostream.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetRegisterInfo.h"
 #include <cstdlib>
@@ -64,21 +65,43 @@ static FunctionPass* createUSCCRegisterAllocator();
 static RegisterRegAlloc usccRegAlloc("uscc", "USCC register allocator",
                                      createUSCCRegisterAllocator);
 
-size_t NUM_COLORS = 4;
+// How many registers the allocator may use. Like REGALLOC_LOG, this is
+// per thread, and is set by whichever thread runs the allocator.
+thread_local size_t NUM_COLORS = 4;
+
+// Where the allocator writes its trace. This is per thread, so that
+// partitions of a module can be allocated concurrently (see
+// Emitter::writeAsm) without their traces getting mixed together.
+thread_local std::ostream* REGALLOC_LOG = &std::cout;
 
 namespace {
-    std::map<LiveInterval*,int> stackMap;
+    // Orders intervals by the position they were pushed on the
+    // coloring stack (intervals that were never pushed count as 0)
     struct CompSpillWeight {
+        explicit CompSpillWeight(const std::map<LiveInterval*,int>* stackMap)
+        : stackMap(stackMap) {}
+        
         bool operator()(LiveInterval *A, LiveInterval *B) const {
 //            return A->weight < B->weight;
-            return stackMap[A] < stackMap[B];
+            return position(A) < position(B);
         }
+        
+        int position(LiveInterval *LI) const {
+            auto iter = stackMap->find(LI);
+            return iter != stackMap->end() ? iter->second : 0;
+        }
+        
+        const std::map<LiveInterval*,int>* stackMap;
     };
+    
+    // Writes the interval to the trace, like LiveInterval::dump does
+    void logInterval(const LiveInterval& LI) {
+        raw_os_ostream os(*REGALLOC_LOG);
+        os << LI << '\n';
+    }
 }
 
 namespace {
-    // PA6: Add any global members needed
-    std::vector<LiveInterval*> liveIntervals;
     class Graph {
     private:
         
@@ -114,7 +137,7 @@ namespace {
         
         void removeNode(int node) {
             presentArray[node] = false;
-            for (int j = 0; j < liveIntervals.size(); j++) {
+            for (int j = 0; j < vertexCount; j++) {
                 if (adjacencyMatrix[node][j]) {
                     removeEdge(node, j);
                 }
@@ -189,6 +212,10 @@ namespace {
         
         Graph* graph;
         
+        // PA6: Add any members needed
+        std::vector<LiveInterval*> liveIntervals;
+        std::map<LiveInterval*,int> stackMap;
+        
         // state
         std::unique_ptr<Spiller> SpillerInstance;
         std::priority_queue<LiveInterval*, std::vector<LiveInterval*>,
@@ -248,7 +275,8 @@ namespace {
     
 } // end anonymous namespace
 
-RAUSCC::RAUSCC(): MachineFunctionPass(ID) {
+RAUSCC::RAUSCC(): MachineFunctionPass(ID), graph(nullptr),
+                   Queue(CompSpillWeight(&stackMap)) {
     initializeLiveDebugVariablesPass(*PassRegistry::getPassRegistry());
     initializeLiveIntervalsPass(*PassRegistry::getPassRegistry());
     initializeSlotIndexesPass(*PassRegistry::getPassRegistry());
@@ -320,7 +348,7 @@ bool RAUSCC::spillInterferences(LiveInterval &VirtReg, unsigned PhysReg,
     DEBUG(dbgs() << "spilling " << TRI->getName(PhysReg) <<
           " interferences with " << VirtReg << "\n");
     assert(!Intfs.empty() && "expected interference");
-    std::cout << "Spilling "; std::cout.flush(); VirtReg.dump();
+    *REGALLOC_LOG << "Spilling "; logInterval(VirtReg);
     // Spill each interfering vreg allocated to PhysReg or an alias.
     for (unsigned i = 0, e = Intfs.size(); i != e; ++i) {
         LiveInterval &Spill = *Intfs[i];
@@ -364,7 +392,7 @@ unsigned RAUSCC::selectOrSplit(LiveInterval &VirtReg,
         switch (Matrix->checkInterference(VirtReg, PhysReg)) {
             case LiveRegMatrix::IK_Free:
                 // PhysReg is available, allocate it.
-                std::cout << "Assigning to physical register: "; std::cout.flush(); VirtReg.dump();
+                *REGALLOC_LOG << "Assigning to physical register: "; logInterval(VirtReg);
                 return PhysReg;
                 
             case LiveRegMatrix::IK_VirtReg:
@@ -392,7 +420,7 @@ unsigned RAUSCC::selectOrSplit(LiveInterval &VirtReg,
     
     // No other spill candidates were found, so spill the current VirtReg.
     DEBUG(dbgs() << "spilling: " << VirtReg << '\n');
-    std::cout << "Spilling "; std::cout.flush(); VirtReg.dump();
+    *REGALLOC_LOG << "Spilling "; logInterval(VirtReg);
     if (!VirtReg.isSpillable())
         return ~0u;
     LiveRangeEdit LRE(&VirtReg, SplitVRegs, *MF, *LIS, VRM);
@@ -407,10 +435,10 @@ bool RAUSCC::runOnMachineFunction(MachineFunction &mf) {
     DEBUG(dbgs() << "********** USCC REGISTER ALLOCATION **********\n"
           << "********** Function: "
           << mf.getName() << '\n');
-    std::cout << "********** USCC REGISTER ALLOCATION **********\n";
+    *REGALLOC_LOG << "********** USCC REGISTER ALLOCATION **********\n";
     std::string funcName(mf.getName());
-    std::cout << "********** Function: " << funcName << '\n';
-    std::cout << "NUM_COLORS=" << NUM_COLORS << '\n';
+    *REGALLOC_LOG << "********** Function: " << funcName << '\n';
+    *REGALLOC_LOG << "NUM_COLORS=" << NUM_COLORS << '\n';
     MF = &mf;
     RegAllocBase::init(getAnalysis<VirtRegMap>(),
                        getAnalysis<LiveIntervals>(),
@@ -496,11 +524,11 @@ void RAUSCC::simplifyGraph() {
                 break;
             }
             int numOfNei = graph->getNumOfEdges(spillIndex);
-            std::cout << "Spill candidate (neighbors=" << numOfNei << ", weight=" << spill->weight << "):";
-            spill->dump();
+            *REGALLOC_LOG << "Spill candidate (neighbors=" << numOfNei << ", weight=" << spill->weight << "):";
+            logInterval(*spill);
             stackMap.insert(std::pair<LiveInterval*, int>(spill, genCounter));
-            std::cout << "Removal " << rmCounter << ": ";
-            spill->dump();
+            *REGALLOC_LOG << "Removal " << rmCounter << ": ";
+            logInterval(*spill);
             graph->removeNode(spillIndex);
             rmCounter++;
             genCounter++;
@@ -516,11 +544,11 @@ bool RAUSCC::checkTrivialAndPush (int &index, int &rmCounter) {
         }
         int numOfNei = graph->getNumOfEdges(i);
         if (numOfNei < NUM_COLORS) {
-            std::cout << "Found neighbors=" << numOfNei << " for ";
-            liveIntervals[i]->dump();
+            *REGALLOC_LOG << "Found neighbors=" << numOfNei << " for ";
+            logInterval(*liveIntervals[i]);
             stackMap.insert(std::pair<LiveInterval*, int>(liveIntervals[i], index));
-            std::cout << "Removal " << rmCounter << ": ";
-            liveIntervals[i]->dump();
+            *REGALLOC_LOG << "Removal " << rmCounter << ": ";
+            logInterval(*liveIntervals[i]);
             graph->removeNode(i);
             index++;
             return true;
@@ -0,0 +1,437 @@
+//
+//  SCCP.cpp
+//  uscc
+//
+//  Implements Sparse Conditional Constant Propagation
+//  (Wegman and Zadeck). Unlike ConstantOps, this finds
+//  constants that flow through phis, and ignores values
+//  coming from edges that can never execute.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/CFG.h>
+#pragma clang diagnostic pop
+#include <unordered_map>
+#include <set>
+#include <vector>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+namespace
+{
+
+// A value is Undefined until something is known about it, then
+// Constant (with mConst set), and Overdefined once it can have
+// more than one value. Values only ever move down this lattice.
+struct LatticeVal
+{
+	enum State
+	{
+		Undefined,
+		Constant,
+		Overdefined
+	};
+	
+	State mState;
+	ConstantInt* mConst;
+};
+
+class SCCPSolver
+{
+public:
+	// Solves the whole function, starting from the entry block
+	void solve(Function& F);
+	
+	LatticeVal getValue(Value* val);
+	
+	bool isExecutable(BasicBlock* block) const
+	{
+		return mExecBlocks.count(block) != 0;
+	}
+	
+private:
+	// Lowers the lattice value of inst, and queues its users if it changed
+	void markConstant(Instruction* inst, ConstantInt* c);
+	void markOverdefined(Instruction* inst);
+	
+	// Marks the edge as executable, and queues whatever has to be
+	// (re)visited because of it
+	void markEdge(BasicBlock* from, BasicBlock* to);
+	
+	void visit(Instruction* inst);
+	void visitPHI(PHINode* phi);
+	void visitTerminator(TerminatorInst* term);
+	
+	// Any branch still on an Undefined condition can't be left with
+	// no executable successors, so its condition is made Overdefined.
+	// Returns true if that happened to any branch.
+	bool resolveUndefBranches(Function& F);
+	
+	std::unordered_map<Value*, LatticeVal> mValues;
+	std::set<BasicBlock*> mExecBlocks;
+	std::set<std::pair<BasicBlock*, BasicBlock*>> mExecEdges;
+	
+	std::vector<Instruction*> mInstWorklist;
+	std::vector<BasicBlock*> mBlockWorklist;
+};
+
+LatticeVal SCCPSolver::getValue(Value* val)
+{
+	if (ConstantInt* c = dyn_cast<ConstantInt>(val))
+	{
+		return LatticeVal{LatticeVal::Constant, c};
+	}
+	
+	// Undef can be assumed to be whatever constant is convenient
+	if (isa<UndefValue>(val))
+	{
+		return LatticeVal{LatticeVal::Undefined, nullptr};
+	}
+	
+	// Arguments, globals and so on could be anything
+	if (!isa<Instruction>(val))
+	{
+		return LatticeVal{LatticeVal::Overdefined, nullptr};
+	}
+	
+	auto iter = mValues.find(val);
+	if (iter == mValues.end())
+	{
+		return LatticeVal{LatticeVal::Undefined, nullptr};
+	}
+	
+	return iter->second;
+}
+
+void SCCPSolver::markConstant(Instruction* inst, ConstantInt* c)
+{
+	LatticeVal& val = mValues[inst];
+	if (val.mState == LatticeVal::Undefined)
+	{
+		val = LatticeVal{LatticeVal::Constant, c};
+	}
+	else if (val.mState == LatticeVal::Constant && val.mConst != c)
+	{
+		val = LatticeVal{LatticeVal::Overdefined, nullptr};
+	}
+	else
+	{
+		return;
+	}
+	
+	for (User* user : inst->users())
+	{
+		mInstWorklist.push_back(cast<Instruction>(user));
+	}
+}
+
+void SCCPSolver::markOverdefined(Instruction* inst)
+{
+	LatticeVal& val = mValues[inst];
+	if (val.mState == LatticeVal::Overdefined)
+	{
+		return;
+	}
+	
+	val = LatticeVal{LatticeVal::Overdefined, nullptr};
+	for (User* user : inst->users())
+	{
+		mInstWorklist.push_back(cast<Instruction>(user));
+	}
+}
+
+void SCCPSolver::markEdge(BasicBlock* from, BasicBlock* to)
+{
+	if (!mExecEdges.insert(std::make_pair(from, to)).second)
+	{
+		return;
+	}
+	
+	if (mExecBlocks.insert(to).second)
+	{
+		// First time this block is reachable, so visit all of it
+		mBlockWorklist.push_back(to);
+	}
+	else
+	{
+		// Only the phis can change because of a new edge
+		for (Instruction& inst : *to)
+		{
+			if (!isa<PHINode>(&inst))
+			{
+				break;
+			}
+			mInstWorklist.push_back(&inst);
+		}
+	}
+}
+
+void SCCPSolver::solve(Function& F)
+{
+	BasicBlock* entry = &F.getEntryBlock();
+	mExecBlocks.insert(entry);
+	mBlockWorklist.push_back(entry);
+	
+	do
+	{
+		while (!mBlockWorklist.empty() || !mInstWorklist.empty())
+		{
+			while (!mInstWorklist.empty())
+			{
+				Instruction* inst = mInstWorklist.back();
+				mInstWorklist.pop_back();
+				
+				// Users in blocks that can't execute don't matter (yet)
+				if (isExecutable(inst->getParent()))
+				{
+					visit(inst);
+				}
+			}
+			
+			while (!mBlockWorklist.empty())
+			{
+				BasicBlock* block = mBlockWorklist.back();
+				mBlockWorklist.pop_back();
+				for (Instruction& inst : *block)
+				{
+					visit(&inst);
+				}
+			}
+		}
+	} while (resolveUndefBranches(F));
+}
+
+void SCCPSolver::visit(Instruction* inst)
+{
+	if (PHINode* phi = dyn_cast<PHINode>(inst))
+	{
+		visitPHI(phi);
+		return;
+	}
+	
+	if (TerminatorInst* term = dyn_cast<TerminatorInst>(inst))
+	{
+		visitTerminator(term);
+		return;
+	}
+	
+	// Only the side-effect free integer ops can be folded
+	if (!isa<BinaryOperator>(inst) && !isa<ICmpInst>(inst) && !isa<CastInst>(inst))
+	{
+		if (!inst->getType()->isVoidTy())
+		{
+			markOverdefined(inst);
+		}
+		return;
+	}
+	
+	// The operands all have to be known constants to fold
+	std::vector<Constant*> ops;
+	for (Value* op : inst->operands())
+	{
+		LatticeVal val = getValue(op);
+		if (val.mState == LatticeVal::Overdefined)
+		{
+			markOverdefined(inst);
+			return;
+		}
+		if (val.mState == LatticeVal::Undefined)
+		{
+			return;
+		}
+		ops.push_back(val.mConst);
+	}
+	
+	llvm::Constant* result = nullptr;
+	if (BinaryOperator* binOp = dyn_cast<BinaryOperator>(inst))
+	{
+		result = ConstantExpr::get(binOp->getOpcode(), ops[0], ops[1]);
+	}
+	else if (ICmpInst* cmp = dyn_cast<ICmpInst>(inst))
+	{
+		result = ConstantExpr::getICmp(cmp->getPredicate(), ops[0], ops[1]);
+	}
+	else
+	{
+		CastInst* cast = llvm::cast<CastInst>(inst);
+		result = ConstantExpr::getCast(cast->getOpcode(), ops[0], cast->getType());
+	}
+	
+	// Folding can fail to give an int, like for a division by zero
+	if (ConstantInt* c = dyn_cast<ConstantInt>(result))
+	{
+		markConstant(inst, c);
+	}
+	else
+	{
+		markOverdefined(inst);
+	}
+}
+
+void SCCPSolver::visitPHI(PHINode* phi)
+{
+	// Merge the values from the edges that can execute
+	ConstantInt* same = nullptr;
+	for (unsigned i = 0; i < phi->getNumIncomingValues(); i++)
+	{
+		if (mExecEdges.count(std::make_pair(phi->getIncomingBlock(i), phi->getParent())) == 0)
+		{
+			continue;
+		}
+		
+		LatticeVal val = getValue(phi->getIncomingValue(i));
+		if (val.mState == LatticeVal::Overdefined ||
+			(val.mState == LatticeVal::Constant && same != nullptr && same != val.mConst))
+		{
+			markOverdefined(phi);
+			return;
+		}
+		if (val.mState == LatticeVal::Constant)
+		{
+			same = val.mConst;
+		}
+	}
+	
+	if (same != nullptr)
+	{
+		markConstant(phi, same);
+	}
+}
+
+void SCCPSolver::visitTerminator(TerminatorInst* term)
+{
+	BasicBlock* block = term->getParent();
+	BranchInst* br = dyn_cast<BranchInst>(term);
+	if (br != nullptr && br->isConditional())
+	{
+		LatticeVal cond = getValue(br->getCondition());
+		if (cond.mState == LatticeVal::Constant)
+		{
+			markEdge(block, br->getSuccessor(cond.mConst->isOne() ? 0 : 1));
+		}
+		else if (cond.mState == LatticeVal::Overdefined)
+		{
+			markEdge(block, br->getSuccessor(0));
+			markEdge(block, br->getSuccessor(1));
+		}
+		return;
+	}
+	
+	// Anything else goes to all of its successors
+	for (unsigned i = 0; i < term->getNumSuccessors(); i++)
+	{
+		markEdge(block, term->getSuccessor(i));
+	}
+}
+
+bool SCCPSolver::resolveUndefBranches(Function& F)
+{
+	bool changed = false;
+	for (BasicBlock* block : mExecBlocks)
+	{
+		BranchInst* br = dyn_cast<BranchInst>(block->getTerminator());
+		if (br == nullptr || !br->isConditional())
+		{
+			continue;
+		}
+		
+		LatticeVal cond = getValue(br->getCondition());
+		if (cond.mState != LatticeVal::Undefined)
+		{
+			continue;
+		}
+		
+		if (Instruction* inst = dyn_cast<Instruction>(br->getCondition()))
+		{
+			markOverdefined(inst);
+		}
+		markEdge(block, br->getSuccessor(0));
+		markEdge(block, br->getSuccessor(1));
+		changed = true;
+	}
+	
+	return changed;
+}
+
+} // anonymous namespace
+
+bool SCCP::runOnFunction(Function& F)
+{
+	SCCPSolver solver;
+	solver.solve(F);
+	
+	bool changed = false;
+	std::vector<Instruction*> removeList;
+	std::vector<BranchInst*> branchList;
+	for (BasicBlock& block : F)
+	{
+		// DeadBlocks removes the blocks that can't execute
+		if (!solver.isExecutable(&block))
+		{
+			continue;
+		}
+		
+		for (Instruction& inst : block)
+		{
+			LatticeVal val = solver.getValue(&inst);
+			if (val.mState == LatticeVal::Constant)
+			{
+				inst.replaceAllUsesWith(val.mConst);
+				removeList.push_back(&inst);
+			}
+		}
+		
+		BranchInst* br = dyn_cast<BranchInst>(block.getTerminator());
+		if (br != nullptr && br->isConditional() &&
+			solver.getValue(br->getCondition()).mState == LatticeVal::Constant)
+		{
+			branchList.push_back(br);
+		}
+	}
+	
+	for (Instruction* inst : removeList)
+	{
+		inst->eraseFromParent();
+		changed = true;
+	}
+	
+	// Fold the branches that can only go one way, so the
+	// blocks that can't execute are no longer reachable
+	for (BranchInst* br : branchList)
+	{
+		BasicBlock* block = br->getParent();
+		unsigned dead = cast<ConstantInt>(br->getCondition())->isOne() ? 1 : 0;
+		BranchInst::Create(br->getSuccessor(1 - dead), br);
+		br->getSuccessor(dead)->removePredecessor(block);
+		br->eraseFromParent();
+		changed = true;
+	}
+	
+	return changed;
+}
+
+void SCCP::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	Info.addRequired<ConstantBranch>();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::SCCP::ID = 0;
@@ -31,50 +31,115 @@
 #pragma clang diagnostic pop
 
 #include <list>
+#include <unordered_set>
+#include <algorithm>
 
 using namespace uscc::opt;
 using namespace uscc::parse;
 using namespace llvm;
 
+SSABuilder::SSABuilder()
+: mNumBlocks(0)
+, mLastBlock(nullptr)
+, mLastBlockNum(0)
+, mStats{0, 0, 0, 0}
+{
+	
+}
+
 // Called when a new function is started to clear out all the data
 void SSABuilder::reset()
 {
 	// PA4: Implement
-	for(auto pair: mVarDefs) {
-		delete pair.second;
-	}
-	for(auto pair: mIncompletePhis) {
-		delete pair.second;
-	}
-	mVarDefs.clear();
-	mIncompletePhis.clear();
-	mSealedBlocks.clear();
+	// The BlockInfos themselves are kept around to be reused
+	mNumBlocks = 0;
+	mBlockNums.clear();
+	mLastBlock = nullptr;
+	mVars.clear();
+	mIsElement.clear();
+	mPhis.clear();
 }
 
 // For a specific variable in a specific basic block, write its value
 void SSABuilder::writeVariable(Identifier* var, BasicBlock* block, Value* value)
 {
 	// PA4: Implement
-	(*mVarDefs[block])[var] = value;
+	writeVariable(getVarNum(var), getBlockNum(block), value);
+}
+
+void SSABuilder::writeVariable(unsigned var, unsigned block, Value* value)
+{
+	std::vector<Value*>& defs = mBlocks[block].mDefs;
+	if (var >= defs.size())
+	{
+		defs.resize(var + 1, nullptr);
+	}
+	defs[var] = value;
+	
+	// Remember where our phis are written, so these definitions can
+	// be updated if the phi is removed
+	if (isa<PHINode>(value))
+	{
+		auto iter = mPhis.find(cast<PHINode>(value));
+		if (iter != mPhis.end())
+		{
+			iter->second.mDefs.emplace_back(block, var);
+		}
+	}
 }
 
 // Read the value assigned to the variable in the requested basic block
-// Will recursively search predecessor blocks if it was not written in this block
+// Will search predecessor blocks if it was not written in this block
 Value* SSABuilder::readVariable(Identifier* var, BasicBlock* block)
 {
 	// PA4: Implement
-	if (mVarDefs[block]->find(var) != mVarDefs[block]->end()) {
-		return (*mVarDefs[block])[var];
+	return readVariable(getVarNum(var), getBlockNum(block));
+}
+
+Value* SSABuilder::readVariable(unsigned var, unsigned block)
+{
+	const std::vector<Value*>& defs = mBlocks[block].mDefs;
+	if (var < defs.size() && defs[var] != nullptr) {
+		return defs[var];
 	}
-	return readVariableRecursive(var, block);
+	
+	size_t base = mReadStack.size();
+	mReadStack.push_back(ReadFrame{var, block, nullptr, 0, 0, 0, true});
+	return runReadStack(base);
+}
+
+// Array elements are numbered right after the array's first element
+void SSABuilder::writeElement(Identifier* array, unsigned index,
+							  BasicBlock* block, Value* value)
+{
+	writeVariable(getVarNum(array) + index, getBlockNum(block), value);
+}
+
+Value* SSABuilder::readElement(Identifier* array, unsigned index, BasicBlock* block)
+{
+	return readVariable(getVarNum(array) + index, getBlockNum(block));
 }
 
 // This is called to add a new block to the maps
 void SSABuilder::addBlock(BasicBlock* block, bool isSealed /* = false */)
 {
 	// PA4: Implement
-	mVarDefs[block] = new SubMap;
-	mIncompletePhis[block] = new SubPHI;
+	if (mNumBlocks == mBlocks.size())
+	{
+		mBlocks.emplace_back();
+	}
+	
+	unsigned num = mNumBlocks++;
+	BlockInfo& info = mBlocks[num];
+	info.mBlock = block;
+	info.mDefs.clear();
+	info.mIncompletePhis.clear();
+	info.mSealed = false;
+	info.mLoopEntry = -1;
+	mBlockNums[block] = num;
+	mLastBlock = block;
+	mLastBlockNum = num;
+	
 	if (isSealed) sealBlock(block);
 }
 
@@ -83,78 +148,231 @@ void SSABuilder::addBlock(BasicBlock* block, bool isSealed /* = false */)
 void SSABuilder::sealBlock(llvm::BasicBlock* block)
 {
 	// PA4: Implement
-	for (auto var: *mIncompletePhis[block]) {
-		addPhiOperands(var.first, var.second);
+	unsigned num = getBlockNum(block);
+	for (size_t i = 0; i < mBlocks[num].mIncompletePhis.size(); i++) {
+		auto incomplete = mBlocks[num].mIncompletePhis[i];
+		addPhiOperands(incomplete.first, incomplete.second);
+	}
+	mBlocks[num].mIncompletePhis.clear();
+	mBlocks[num].mSealed = true;
+}
+
+// Seals a loop header before its back edges exist
+void SSABuilder::sealLoopHeader(BasicBlock* header,
+								const std::vector<AssignedVar>& assigned)
+{
+	unsigned num = getBlockNum(header);
+	if (header->getSinglePredecessor() != nullptr) {
+		mBlocks[num].mLoopEntry = static_cast<int>(getBlockNum(header->getSinglePredecessor()));
 	}
-	mSealedBlocks.insert(block);
-	for (auto var : *mVarDefs[block]){
-		if (isa<PHINode>(var.second))
-			var.second = tryRemoveTrivialPhi(cast<PHINode>(var.second));
+	for (const AssignedVar& assign : assigned) {
+		unsigned var = getVarNum(assign.mIdent);
+		if (assign.mElement != -1) {
+			// Only promoted arrays' elements are variables
+			if (!assign.mIdent->canPromoteArray()) {
+				continue;
+			}
+			var += static_cast<unsigned>(assign.mElement);
+		}
+		PHINode* phi = createPhi(var, num);
+		mBlocks[num].mIncompletePhis.emplace_back(var, phi);
+		writeVariable(var, num, phi);
 	}
+	mBlocks[num].mSealed = true;
 }
 
-// Recursively search predecessor blocks for a variable
-Value* SSABuilder::readVariableRecursive(Identifier* var, BasicBlock* block)
+// Searches predecessor blocks for variables, for every frame on the
+// stack above base. This does exactly what the recursive algorithm
+// would, in the same order, so the same phis are created:
+//
+// readVariableRecursive(var, block):
+//     if block isn't sealed: val = new incomplete phi
+//     else if block is a loop header: val = readVariable(var, loop entry)
+//     else if block has one pred: val = readVariable(var, pred)
+//     else: val = new phi, writeVariable(var, block, val)
+//           val = addPhiOperands(var, val)
+//     writeVariable(var, block, val)
+Value* SSABuilder::runReadStack(size_t base)
 {
-	Value* retVal = nullptr;
+	// The result of the most recently finished frame, if that
+	// frame was the child of the one now on top
+	Value* result = nullptr;
+	bool haveResult = false;
 	
-	// PA4: Implement
-	if (mSealedBlocks.find(block) == mSealedBlocks.end()) {
-        PHINode* phi;
-        if (block->empty()) {
-            IRBuilder<> build(block);
-            phi = build.CreatePHI(var->llvmType(), 0);
-        } else {
-            IRBuilder<> build(&block->front());
-            phi = build.CreatePHI(var->llvmType(), 0);
-        }
-        
-		(*mIncompletePhis[block])[var] = phi;
-		retVal = phi;
-	} else if (block->getSinglePredecessor() != nullptr) {
-		retVal = readVariable(var, block->getSinglePredecessor());
-	} else {
-
-        PHINode* phi;
-        if (block->empty()) {
-            IRBuilder<> build(block);
-            phi = build.CreatePHI(var->llvmType(), 0);
-        } else {
-            IRBuilder<> build(&block->front());
-            phi = build.CreatePHI(var->llvmType(), 0);
-        }
-		writeVariable(var, block, phi);
-		retVal = addPhiOperands(var, phi);
+	while (mReadStack.size() > base) {
+		ReadFrame& frame = mReadStack.back();
+		unsigned var = frame.mVar;
+		unsigned block = frame.mBlock;
+		
+		if (frame.mPhi == nullptr) {
+			if (haveResult) {
+				// Our single predecessor returned
+				writeVariable(var, block, result);
+				mReadStack.pop_back();
+				continue;
+			}
+			
+			// First visit, so check this block
+			const std::vector<Value*>& defs = mBlocks[block].mDefs;
+			if (var < defs.size() && defs[var] != nullptr) {
+				result = defs[var];
+				haveResult = true;
+				mReadStack.pop_back();
+				continue;
+			}
+			
+			BasicBlock* bb = mBlocks[block].mBlock;
+			if (!mBlocks[block].mSealed) {
+				PHINode* phi = createPhi(var, block);
+				mBlocks[block].mIncompletePhis.emplace_back(var, phi);
+				writeVariable(var, block, phi);
+				result = phi;
+				haveResult = true;
+				mReadStack.pop_back();
+			} else if (mBlocks[block].mLoopEntry >= 0) {
+				unsigned pred = static_cast<unsigned>(mBlocks[block].mLoopEntry);
+				mReadStack.push_back(ReadFrame{var, pred, nullptr, 0, 0, 0, true});
+			} else if (bb->getSinglePredecessor() != nullptr) {
+				unsigned pred = getBlockNum(bb->getSinglePredecessor());
+				mReadStack.push_back(ReadFrame{var, pred, nullptr, 0, 0, 0, true});
+			} else {
+				PHINode* phi = createPhi(var, block);
+				writeVariable(var, block, phi);
+				// This frame turns into the one adding the operands
+				mReadStack.pop_back();
+				pushPhiOperands(var, block, phi, true);
+			}
+		} else {
+			if (haveResult) {
+				// The read for the next predecessor returned
+				frame.mPhi->addIncoming(result, mPreds[frame.mNextPred]);
+				frame.mNextPred++;
+				haveResult = false;
+			}
+			
+			if (frame.mNextPred < frame.mEndPred) {
+				unsigned pred = getBlockNum(mPreds[frame.mNextPred]);
+				mReadStack.push_back(ReadFrame{var, pred, nullptr, 0, 0, 0, true});
+				continue;
+			}
+			
+			// All the operands are in
+			mPhis[frame.mPhi].mComplete = true;
+			result = tryRemoveTrivialPhi(frame.mPhi);
+			haveResult = true;
+			if (frame.mWriteResult) {
+				writeVariable(var, block, result);
+			}
+			mPreds.resize(frame.mFirstPred);
+			mReadStack.pop_back();
+		}
 	}
 	
-	writeVariable(var, block, retVal);
-	return retVal;
+	return result;
 }
 
-// Adds phi operands based on predecessors of the containing block
-Value* SSABuilder::addPhiOperands(Identifier* var, PHINode* phi)
+// Pushes a frame that adds the operands of the phi
+void SSABuilder::pushPhiOperands(unsigned var, unsigned block, PHINode* phi,
+								 bool writeResult)
 {
-	// PA4: Implement
+	size_t begin = mPreds.size();
 	for (auto it = pred_begin(phi->getParent()); it != pred_end(phi->getParent()); ++it){
-		phi->addIncoming(readVariable(var, *it), *it);
+		mPreds.push_back(*it);
 	}
-	
-	return tryRemoveTrivialPhi(phi);
+	mReadStack.push_back(ReadFrame{var, block, phi, begin, begin, mPreds.size(), writeResult});
+}
+
+// Adds phi operands based on predecessors of the containing block
+Value* SSABuilder::addPhiOperands(unsigned var, PHINode* phi)
+{
+	// PA4: Implement
+	size_t base = mReadStack.size();
+	pushPhiOperands(var, getBlockNum(phi->getParent()), phi, false);
+	return runReadStack(base);
 }
 
 // Removes trivial phi nodes
 Value* SSABuilder::tryRemoveTrivialPhi(llvm::PHINode* phi)
 {
-	Value* same = nullptr;
-	
 	// PA4: Implement
-	for (int i = 0; i < phi->getNumOperands(); i++) {
+	// Removing a phi can make the phis that use it trivial, so those are
+	// checked next. Removed phis aren't erased until the end, so none of
+	// the pointers on the worklist can dangle.
+	mPhiWorklist.push_back(phi);
+	while (!mPhiWorklist.empty()) {
+		PHINode* curr = mPhiWorklist.back();
+		mPhiWorklist.pop_back();
+		
+		PhiInfo& info = mPhis[curr];
+		if (info.mReplacement != nullptr) {
+			continue;
+		}
+		
+		Value* same = getTrivialValue(curr);
+		if (same == nullptr) {
+			continue;
+		}
+		
+		for (auto use = curr->use_begin(); use != curr->use_end(); ++use) {
+			PHINode* user = dyn_cast<PHINode>(use->getUser());
+			if (user != nullptr && user != curr) {
+				auto iter = mPhis.find(user);
+				if (iter != mPhis.end() && iter->second.mComplete) {
+					mPhiWorklist.push_back(user);
+				}
+			}
+		}
+		
+		curr->replaceAllUsesWith(same);
+		info.mReplacement = same;
+		mRemovedPhis.push_back(curr);
+		mStats.mTrivial++;
+		
+		// Only the definitions that still refer to the phi are updated
+		// (writeVariable also records them for same, if it's a phi)
+		std::vector<std::pair<unsigned, unsigned>> defs;
+		defs.swap(info.mDefs);
+		for (auto& def : defs) {
+			unsigned block = def.first;
+			unsigned var = def.second;
+			if (mBlocks[block].mDefs[var] == curr) {
+				writeVariable(var, block, same);
+			}
+		}
+	}
+	
+	// If what the phi was replaced with was removed later, follow
+	// the chain of replacements
+	Value* retVal = phi;
+	while (isa<PHINode>(retVal)) {
+		auto iter = mPhis.find(cast<PHINode>(retVal));
+		if (iter == mPhis.end() || iter->second.mReplacement == nullptr) {
+			break;
+		}
+		retVal = iter->second.mReplacement;
+	}
+	
+	for (PHINode* removed : mRemovedPhis) {
+		mPhis.erase(removed);
+		removed->eraseFromParent();
+	}
+	mRemovedPhis.clear();
+	
+	return retVal;
+}
+
+// Returns the value the phi is equivalent to, or nullptr
+// if it merges more than one value
+Value* SSABuilder::getTrivialValue(PHINode* phi)
+{
+	Value* same = nullptr;
+	for (unsigned i = 0; i < phi->getNumIncomingValues(); i++) {
 		auto op = phi->getIncomingValue(i);
 		if (op == same || op == phi) {
 			continue;
 		}
 		if (same != nullptr) {
-			return phi;
+			return nullptr;
 		}
 		same = op;
 	}
@@ -162,24 +380,277 @@ Value* SSABuilder::tryRemoveTrivialPhi(llvm::PHINode* phi)
 		same = UndefValue::get(phi->getType());
 	}
 	
-	std::vector<Value*> users;
+	return same;
+}
+
+// Creates an empty phi for the variable at the start of the block
+PHINode* SSABuilder::createPhi(unsigned var, unsigned block)
+{
+	BasicBlock* bb = mBlocks[block].mBlock;
+	llvm::Type* type = nullptr;
+	if (mIsElement[var]) {
+		if (mVars[var]->getType() == parse::Type::IntArray) {
+			type = llvm::Type::getInt32Ty(bb->getContext());
+		} else {
+			type = llvm::Type::getInt8Ty(bb->getContext());
+		}
+	} else {
+		type = mVars[var]->llvmType(bb->getContext());
+	}
+	PHINode* phi = nullptr;
+	if (bb->empty()) {
+		IRBuilder<> build(bb);
+		phi = build.CreatePHI(type, 0);
+	} else {
+		IRBuilder<> build(&bb->front());
+		phi = build.CreatePHI(type, 0);
+	}
+	
+	mStats.mCreated++;
+	PhiInfo& info = mPhis[phi];
+	info.mDefs.clear();
+	info.mComplete = false;
+	info.mReplacement = nullptr;
+	return phi;
+}
+
+// Returns the number of the block (which must have been added)
+unsigned SSABuilder::getBlockNum(BasicBlock* block)
+{
+	if (block != mLastBlock)
+	{
+		mLastBlock = block;
+		mLastBlockNum = mBlockNums[block];
+	}
+	
+	return mLastBlockNum;
+}
+
+// Returns the number of the variable, numbering it if it's new
+unsigned SSABuilder::getVarNum(Identifier* var)
+{
+	unsigned id = var->getId();
+	if (id >= mVarNums.size())
+	{
+		mVarNums.resize(id + 1, 0);
+	}
+	
+	unsigned num = mVarNums[id];
+	if (num >= mVars.size() || mVars[num] != var)
+	{
+		num = static_cast<unsigned>(mVars.size());
+		mVarNums[id] = num;
+		if (var->canPromoteArray()) {
+			mVars.resize(num + var->getArrayCount(), var);
+			mIsElement.resize(num + var->getArrayCount(), true);
+		} else {
+			mVars.push_back(var);
+			mIsElement.push_back(false);
+		}
+	}
+	
+	return num;
+}
+
+// Collapses redundant phi SCCs, and then deletes unused phis
+void SSABuilder::minimizePhis(Function& func)
+{
+	std::vector<PHINode*> phis;
+	for (BasicBlock& block : func) {
+		for (auto iter = block.begin(); iter != block.end() && isa<PHINode>(*iter); ++iter) {
+			phis.push_back(cast<PHINode>(&*iter));
+		}
+	}
+	
+	removeRedundantPhis(phis);
+	removeDeadPhis(func);
+}
+
+// Adds the counts from another builder
+void SSABuilder::addStats(const Stats& other)
+{
+	mStats.mCreated += other.mCreated;
+	mStats.mTrivial += other.mTrivial;
+	mStats.mRedundant += other.mRedundant;
+	mStats.mDead += other.mDead;
+}
+
+// Replaces every phi in the set that belongs to a redundant SCC
+void SSABuilder::removeRedundantPhis(const std::vector<PHINode*>& phis)
+{
+	std::vector<std::vector<PHINode*>> sccs;
+	findPhiSCCs(phis, sccs);
+	
+	// Since the operands of an SCC come first, collapsing an SCC
+	// can make the ones after it redundant
+	for (auto& scc : sccs) {
+		std::unordered_set<Value*> inSCC(scc.begin(), scc.end());
+		
+		// The phis with only operands in the SCC, and the values
+		// from outside of the SCC
+		std::vector<PHINode*> inner;
+		std::vector<Value*> outerOps;
+		for (PHINode* phi : scc) {
+			bool isInner = true;
+			for (unsigned i = 0; i < phi->getNumIncomingValues(); i++) {
+				Value* op = phi->getIncomingValue(i);
+				if (inSCC.count(op) == 0) {
+					isInner = false;
+					if (std::find(outerOps.begin(), outerOps.end(), op) == outerOps.end()) {
+						outerOps.push_back(op);
+					}
+				}
+			}
+			
+			if (isInner) {
+				inner.push_back(phi);
+			}
+		}
+		
+		if (outerOps.size() == 1) {
+			// The whole SCC is just this one value
+			for (PHINode* phi : scc) {
+				phi->replaceAllUsesWith(outerOps[0]);
+			}
+			for (PHINode* phi : scc) {
+				phi->eraseFromParent();
+			}
+			mStats.mRedundant += scc.size();
+		} else if (outerOps.size() > 1 && !inner.empty()) {
+			// The SCC itself merges several values, but there
+			// might still be redundant SCCs among the inner phis
+			removeRedundantPhis(inner);
+		}
+	}
+}
+
+// Finds the strongly connected components of the phis with Tarjan's
+// algorithm. This uses an explicit stack, like readVariable does.
+void SSABuilder::findPhiSCCs(const std::vector<PHINode*>& phis,
+							 std::vector<std::vector<PHINode*>>& sccs)
+{
+	struct NodeInfo
+	{
+		unsigned mIndex;
+		unsigned mLowLink;
+		bool mOnStack;
+	};
 	
-	for (auto it = phi->use_begin(); it != phi->use_end(); ++it) {
-		if (*it != phi) users.push_back(*it);
+	// Only phis in this map are part of the graph
+	std::unordered_map<Value*, NodeInfo> nodes;
+	const unsigned unvisited = ~0u;
+	for (PHINode* phi : phis) {
+		nodes[phi] = NodeInfo{unvisited, 0, false};
 	}
-	phi->replaceAllUsesWith(same);
-	if (!phi->getParent()) {
-		return phi;
+	
+	// (phi, number of operands visited so far)
+	std::vector<std::pair<PHINode*, unsigned>> callStack;
+	std::vector<PHINode*> sccStack;
+	unsigned nextIndex = 0;
+	
+	for (PHINode* root : phis) {
+		if (nodes[root].mIndex != unvisited) {
+			continue;
+		}
+		
+		nodes[root] = NodeInfo{nextIndex, nextIndex, true};
+		nextIndex++;
+		sccStack.push_back(root);
+		callStack.emplace_back(root, 0);
+		
+		while (!callStack.empty()) {
+			PHINode* phi = callStack.back().first;
+			unsigned op = callStack.back().second;
+			NodeInfo& info = nodes[phi];
+			
+			if (op < phi->getNumIncomingValues()) {
+				callStack.back().second++;
+				
+				auto iter = nodes.find(phi->getIncomingValue(op));
+				if (iter == nodes.end()) {
+					continue;
+				}
+				
+				NodeInfo& opInfo = iter->second;
+				if (opInfo.mIndex == unvisited) {
+					opInfo = NodeInfo{nextIndex, nextIndex, true};
+					nextIndex++;
+					PHINode* opPhi = cast<PHINode>(iter->first);
+					sccStack.push_back(opPhi);
+					callStack.emplace_back(opPhi, 0);
+				} else if (opInfo.mOnStack) {
+					info.mLowLink = std::min(info.mLowLink, opInfo.mIndex);
+				}
+				continue;
+			}
+			
+			// All the operands are done, so check if this is an SCC root
+			if (info.mLowLink == info.mIndex) {
+				sccs.emplace_back();
+				PHINode* member = nullptr;
+				do {
+					member = sccStack.back();
+					sccStack.pop_back();
+					nodes[member].mOnStack = false;
+					sccs.back().push_back(member);
+				} while (member != phi);
+			}
+			
+			unsigned lowLink = info.mLowLink;
+			callStack.pop_back();
+			if (!callStack.empty()) {
+				NodeInfo& parent = nodes[callStack.back().first];
+				parent.mLowLink = std::min(parent.mLowLink, lowLink);
+			}
+		}
 	}
-	auto map = mVarDefs[phi->getParent()];
-	for (auto it : *map){
-		if (it.second == phi) {
-			(*map)[it.first] = same;
+}
+
+// Deletes all the phis that don't (transitively) have a user
+// that isn't a phi
+void SSABuilder::removeDeadPhis(Function& func)
+{
+	std::vector<PHINode*> phis;
+	std::unordered_set<PHINode*> live;
+	std::vector<PHINode*> worklist;
+	for (BasicBlock& block : func) {
+		for (auto iter = block.begin(); iter != block.end() && isa<PHINode>(*iter); ++iter) {
+			PHINode* phi = cast<PHINode>(&*iter);
+			phis.push_back(phi);
+			
+			for (auto use = phi->use_begin(); use != phi->use_end(); ++use) {
+				if (!isa<PHINode>(use->getUser())) {
+					live.insert(phi);
+					worklist.push_back(phi);
+					break;
+				}
+			}
 		}
 	}
-	for (auto use : users){
-		if (isa<PHINode>(use)) tryRemoveTrivialPhi(cast<PHINode>(use));
+	
+	// Any phi used by a live phi is live too
+	while (!worklist.empty()) {
+		PHINode* phi = worklist.back();
+		worklist.pop_back();
+		for (unsigned i = 0; i < phi->getNumIncomingValues(); i++) {
+			PHINode* op = dyn_cast<PHINode>(phi->getIncomingValue(i));
+			if (op != nullptr && live.insert(op).second) {
+				worklist.push_back(op);
+			}
+		}
 	}
-	phi->eraseFromParent();
 	
-	return same;}
+	// The dead phis can only be used by each other, so once all
+	// their references are dropped they can be erased in any order
+	std::vector<PHINode*> dead;
+	for (PHINode* phi : phis) {
+		if (live.count(phi) == 0) {
+			phi->dropAllReferences();
+			dead.push_back(phi);
+		}
+	}
+	for (PHINode* phi : dead) {
+		phi->eraseFromParent();
+	}
+	mStats.mDead += dead.size();
+}
@@ -15,7 +15,8 @@
 
 #pragma once
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
+#include <cstddef>
 
 // LLVM forward-declarations
 namespace llvm
@@ -23,6 +24,7 @@ namespace llvm
 	class BasicBlock;
 	class Value;
 	class PHINode;
+	class Function;
 }
 
 namespace uscc
@@ -30,6 +32,7 @@ namespace uscc
 namespace parse
 {
 	class Identifier;
+	struct AssignedVar;
 }
 	
 namespace opt
@@ -42,6 +45,8 @@ namespace opt
 class SSABuilder
 {
 public:
+	SSABuilder();
+	
 	// Called when a new function is started to clear out all the data
 	void reset();
 	
@@ -49,9 +54,16 @@ public:
 	void writeVariable(parse::Identifier* var, llvm::BasicBlock* block, llvm::Value* value);
 	
 	// Read the value assigned to the variable in the requested basic block
-	// Will recursively search predecessor blocks if it was not written in this block
+	// Will search predecessor blocks if it was not written in this block
 	llvm::Value* readVariable(parse::Identifier* var, llvm::BasicBlock* block);
 	
+	// The same, for an element of an array that's promoted to
+	// registers (each element is a separate variable)
+	void writeElement(parse::Identifier* array, unsigned index,
+					  llvm::BasicBlock* block, llvm::Value* value);
+	llvm::Value* readElement(parse::Identifier* array, unsigned index,
+							 llvm::BasicBlock* block);
+	
 	// This is called to add a new block to the maps
 	// If the block is sealed, will automatically call "seal block" on it
 	void addBlock(llvm::BasicBlock* block, bool isSealed = false);
@@ -59,29 +71,183 @@ public:
 	// This is called when a block is "sealed" which means it will not have any
 	// further predecessors added. It will complete any PHI nodes (if necessary)
 	void sealBlock(llvm::BasicBlock* block);
+	
+	// Seals a loop header whose back edges don't exist yet. Only the
+	// variables in assigned can differ around the loop, so each of those
+	// gets an incomplete phi right away, and every other variable is read
+	// from the header's current predecessors. sealBlock must still be
+	// called once the back edges are added, to complete the phis.
+	void sealLoopHeader(llvm::BasicBlock* header,
+						const std::vector<parse::AssignedVar>& assigned);
+	
+	// Called once the function is completely emitted. Removing trivial phis
+	// during construction can still leave behind groups of phis that only
+	// refer to each other and one other value, and phis that are never used.
+	// This collapses each of those groups to its value (section 3.2 of the
+	// paper), and then deletes the unused phis.
+	void minimizePhis(llvm::Function& func);
+	
+	// Counts of phis over every function built so far
+	struct Stats
+	{
+		size_t mCreated;
+		size_t mTrivial;
+		size_t mRedundant;
+		size_t mDead;
+	};
+	
+	const Stats& getStats() const
+	{
+		return mStats;
+	}
+	
+	// Adds the counts from another builder
+	// (used to combine the builders of parallel emission)
+	void addStats(const Stats& other);
 private:
+	// Blocks and variables are numbered densely per function, so all of the
+	// per-block data lives in flat tables indexed by those numbers.
+	struct BlockInfo
+	{
+		llvm::BasicBlock* mBlock;
+		
+		// The current definition of each variable in this block,
+		// indexed by variable number (nullptr if there isn't one)
+		std::vector<llvm::Value*> mDefs;
+		
+		// Any incomplete PHI nodes, as (variable number, phi) pairs
+		std::vector<std::pair<unsigned, llvm::PHINode*>> mIncompletePhis;
+		
+		bool mSealed;
+		
+		// For loop headers sealed with sealLoopHeader, the number of the
+		// block that enters the loop (-1 otherwise). Variables that aren't
+		// assigned in the loop always have that block's value.
+		int mLoopEntry;
+	};
+	
+	// Variable lookups walk predecessor blocks with an explicit stack
+	// of these (rather than recursion), so that deep CFGs can't
+	// overflow the call stack.
+	struct ReadFrame
+	{
+		unsigned mVar;
+		unsigned mBlock;
+		
+		// If non-null, this frame is adding the operands of this phi,
+		// from the predecessors mPreds[mFirstPred..mEndPred)
+		llvm::PHINode* mPhi;
+		size_t mFirstPred;
+		size_t mNextPred;
+		size_t mEndPred;
+		
+		// Whether the result gets written as the variable's
+		// definition in mBlock
+		bool mWriteResult;
+	};
+	
+	// Bookkeeping for each phi the builder creates
+	struct PhiInfo
+	{
+		// Every (block, variable number) this phi has been written to
+		// as a definition. Entries can be stale if the definition was
+		// overwritten since, so they're checked before use.
+		std::vector<std::pair<unsigned, unsigned>> mDefs;
+		
+		// False until all the phi's operands are added. Incomplete
+		// phis can't be checked for triviality.
+		bool mComplete;
+		
+		// Set once the phi is found to be trivial
+		llvm::Value* mReplacement;
+	};
+	
 	// Helper functions
 	
-	// Recursively search predecessor blocks for a variable
-	llvm::Value* readVariableRecursive(parse::Identifier* var, llvm::BasicBlock* block);
+	// Runs the frames on mReadStack above base, and returns the
+	// result of the bottom one
+	llvm::Value* runReadStack(size_t base);
+	
+	// Pushes a frame that adds the operands of the phi
+	void pushPhiOperands(unsigned var, unsigned block, llvm::PHINode* phi,
+						 bool writeResult);
+	
+	// Array based versions of the public functions
+	llvm::Value* readVariable(unsigned var, unsigned block);
+	void writeVariable(unsigned var, unsigned block, llvm::Value* value);
 	
 	// Adds phi operands based on predecessors of the containing block
-	llvm::Value* addPhiOperands(parse::Identifier* var, llvm::PHINode* phi);
+	llvm::Value* addPhiOperands(unsigned var, llvm::PHINode* phi);
 	
-	// Removes trivial phi nodes
+	// Removes the phi if it's trivial, along with any phis that
+	// become trivial as a result. Returns what the phi was replaced
+	// with (or the phi itself, if it isn't trivial).
 	llvm::Value* tryRemoveTrivialPhi(llvm::PHINode* phi);
 	
-	typedef std::unordered_map<parse::Identifier*, llvm::Value*> SubMap;
-	typedef std::unordered_map<parse::Identifier*, llvm::PHINode*> SubPHI;
+	// Returns the value the phi is equivalent to, or nullptr
+	// if it merges more than one value
+	llvm::Value* getTrivialValue(llvm::PHINode* phi);
+	
+	// Replaces every phi in the set that belongs to a redundant SCC
+	void removeRedundantPhis(const std::vector<llvm::PHINode*>& phis);
+	
+	// Finds the strongly connected components of the phis (where each phi
+	// has an edge to its operands in the set) with Tarjan's algorithm. The
+	// SCCs are added in reverse topological order, so an SCC's operands
+	// always come before it.
+	void findPhiSCCs(const std::vector<llvm::PHINode*>& phis,
+					 std::vector<std::vector<llvm::PHINode*>>& sccs);
+	
+	// Deletes all the phis that don't (transitively) have a user
+	// that isn't a phi
+	void removeDeadPhis(llvm::Function& func);
+	
+	// Creates an empty phi for the variable at the start of the block
+	llvm::PHINode* createPhi(unsigned var, unsigned block);
+	
+	// Returns the number of the block (which must have been added)
+	unsigned getBlockNum(llvm::BasicBlock* block);
+	
+	// Returns the number of the variable, numbering it if it's new.
+	// Promoted arrays are numbered with one variable per element,
+	// and this returns the number of the first.
+	unsigned getVarNum(parse::Identifier* var);
+	
+	// Data for each block in the current function. Entries past
+	// mNumBlocks are left over from previous functions, and are
+	// reused so their vectors don't have to be reallocated.
+	std::vector<BlockInfo> mBlocks;
+	unsigned mNumBlocks;
+	
+	// Maps each block to its number
+	std::unordered_map<llvm::BasicBlock*, unsigned> mBlockNums;
+	
+	// Almost every access is to the block currently being emitted,
+	// so the last block looked up is cached
+	llvm::BasicBlock* mLastBlock;
+	unsigned mLastBlockNum;
+	
+	// Info for each phi created in the current function
+	std::unordered_map<llvm::PHINode*, PhiInfo> mPhis;
+	
+	// Scratch space for tryRemoveTrivialPhi
+	std::vector<llvm::PHINode*> mPhiWorklist;
+	std::vector<llvm::PHINode*> mRemovedPhis;
+	
+	// Stack for variable lookups, and the predecessors the
+	// phi frames on it are iterating over
+	std::vector<ReadFrame> mReadStack;
+	std::vector<llvm::BasicBlock*> mPreds;
 	
-	// This stores the variable definitions for a particular basic block
-	std::unordered_map<llvm::BasicBlock*, SubMap*> mVarDefs;
+	Stats mStats;
 	
-	// This stores any incomplete PHI nodes
-	std::unordered_map<llvm::BasicBlock*, SubPHI*> mIncompletePhis;
+	// Sparse set that maps identifier ids to variable numbers:
+	// var is numbered if mVars[mVarNums[var->getId()]] == var
+	std::vector<unsigned> mVarNums;
+	std::vector<parse::Identifier*> mVars;
 	
-	// Set of all the sealed blocks in the current function
-	std::unordered_set<llvm::BasicBlock*> mSealedBlocks;
+	// Whether each variable number is an element of a promoted array
+	std::vector<bool> mIsElement;
 };
 	
 } // opt
@@ -0,0 +1,354 @@
+//
+//  ScalarPromotion.cpp
+//  uscc
+//
+//  Implements scalar promotion of array elements in loops.
+//  An element that's accessed at a loop invariant address,
+//  which nothing else in the loop may alias, is loaded once
+//  in the preheader and kept in a register across the loop.
+//  SSAUpdater creates the phis for the register, and its
+//  final value is stored back in each exit block.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/IR/ValueHandle.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Utils/SSAUpdater.h>
+#pragma clang diagnostic pop
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+namespace
+{
+
+// Whether addr is a constant element within the bounds of a local or
+// global array, so it can be accessed without the program having to.
+// Array elements are addressed by a GEP from the start of the array,
+// which may be followed by more GEPs from that element.
+bool isValidElement(Value* addr)
+{
+	int64_t offset = 0;
+	while (GEPOperator* gep = dyn_cast<GEPOperator>(addr))
+	{
+		ConstantInt* idx = dyn_cast<ConstantInt>(gep->getOperand(gep->getNumOperands() - 1));
+		if (idx == nullptr)
+		{
+			return false;
+		}
+		offset += idx->getSExtValue();
+		addr = gep->getPointerOperand();
+		
+		if (gep->getNumOperands() == 3)
+		{
+			ConstantInt* first = dyn_cast<ConstantInt>(gep->getOperand(1));
+			ArrayType* arrayType = dyn_cast<ArrayType>(addr->getType()->getPointerElementType());
+			if (first == nullptr || !first->isZero() || arrayType == nullptr ||
+				!(isa<AllocaInst>(addr) || isa<GlobalVariable>(addr)))
+			{
+				return false;
+			}
+			
+			return offset >= 0 &&
+				static_cast<uint64_t>(offset) < arrayType->getNumElements();
+		}
+		else if (gep->getNumOperands() != 2)
+		{
+			return false;
+		}
+	}
+	
+	return offset == 0 && addr->isDereferenceablePointer();
+}
+
+} // anonymous namespace
+
+bool ScalarPromotion::runOnLoop(Loop* L, LPPassManager& LPM)
+{
+	mChanged = false;
+	mCurrLoop = L;
+	mPreheader = L->getLoopPreheader();
+	mDomTree = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+	
+	// The stores go in the exit blocks, so those can't be
+	// reachable from outside the loop
+	if (mPreheader == nullptr || !L->hasDedicatedExits())
+	{
+		return false;
+	}
+	
+	if (!findAccesses())
+	{
+		return false;
+	}
+	
+	for (auto& addr : mAddresses)
+	{
+		if (canPromote(addr))
+		{
+			promote(addr);
+		}
+	}
+	
+	return mChanged;
+}
+
+bool ScalarPromotion::findAccesses()
+{
+	mAddresses.clear();
+	
+	// This includes the blocks of any nested loops
+	for (auto block : mCurrLoop->getBlocks())
+	{
+		for (auto& inst : *block)
+		{
+			Value* addr = nullptr;
+			Type* type = nullptr;
+			// Lifetime markers clobber the array, so anything
+			// they may alias can't be promoted
+			bool promotable = false;
+			if (LoadInst* load = dyn_cast<LoadInst>(&inst))
+			{
+				addr = load->getPointerOperand();
+				type = load->getType();
+				promotable = !load->isVolatile();
+			}
+			else if (StoreInst* store = dyn_cast<StoreInst>(&inst))
+			{
+				addr = store->getPointerOperand();
+				type = store->getValueOperand()->getType();
+				promotable = !store->isVolatile();
+			}
+			else if (IntrinsicInst* intrinsic = dyn_cast<IntrinsicInst>(&inst))
+			{
+				if (intrinsic->getIntrinsicID() != Intrinsic::lifetime_start &&
+					intrinsic->getIntrinsicID() != Intrinsic::lifetime_end)
+				{
+					return false;
+				}
+				addr = intrinsic->getArgOperand(1);
+			}
+			else if (CallInst* call = dyn_cast<CallInst>(&inst))
+			{
+				// Anything else the callee could read or write would
+				// miss the values kept in registers
+				Function* callee = call->getCalledFunction();
+				if (callee == nullptr || !callee->doesNotAccessMemory())
+				{
+					return false;
+				}
+				continue;
+			}
+			else
+			{
+				continue;
+			}
+			
+			// Group the access with the others at the same address
+			AddressAccesses* accesses = nullptr;
+			for (auto& other : mAddresses)
+			{
+				if (other.mAddr == addr)
+				{
+					accesses = &other;
+					break;
+				}
+			}
+			
+			if (accesses == nullptr)
+			{
+				mAddresses.push_back(AddressAccesses());
+				accesses = &mAddresses.back();
+				accesses->mAddr = addr;
+				accesses->mType = type;
+				accesses->mHasStore = false;
+				accesses->mPromotable = true;
+			}
+			
+			if (type != accesses->mType)
+			{
+				promotable = false;
+			}
+			
+			accesses->mInsts.push_back(&inst);
+			accesses->mHasStore |= isa<StoreInst>(&inst);
+			accesses->mPromotable &= promotable;
+		}
+	}
+	
+	return true;
+}
+
+bool ScalarPromotion::canPromote(const AddressAccesses& accesses)
+{
+	// Elements that are only read are already hoisted by LICM
+	if (!accesses.mPromotable || !accesses.mHasStore ||
+		!mCurrLoop->isLoopInvariant(accesses.mAddr))
+	{
+		return false;
+	}
+	
+	Value* object = GetUnderlyingObject(accesses.mAddr);
+	if (GlobalVariable* global = dyn_cast<GlobalVariable>(object))
+	{
+		if (global->isConstant())
+		{
+			return false;
+		}
+	}
+	
+	// An access through a pointer that could point anywhere (including
+	// those in nested loops) may hit the element, and wouldn't see the
+	// value in the register
+	for (auto& other : mAddresses)
+	{
+		if (!hasIdentifiedObjects(other.mAddr) ||
+			(&other != &accesses && mayAlias(other.mAddr, accesses.mAddr)))
+		{
+			return false;
+		}
+	}
+	
+	// The load in the preheader (and the stores at the exits) happen
+	// even if the loop exits before the element is accessed, so the
+	// address must be valid regardless
+	if (isValidElement(accesses.mAddr))
+	{
+		return true;
+	}
+	
+	SmallVector<BasicBlock*, 4> exitingBlocks;
+	mCurrLoop->getExitingBlocks(exitingBlocks);
+	for (auto inst : accesses.mInsts)
+	{
+		bool guaranteed = true;
+		for (auto exiting : exitingBlocks)
+		{
+			if (!mDomTree->dominates(inst->getParent(), exiting))
+			{
+				guaranteed = false;
+				break;
+			}
+		}
+		
+		if (guaranteed)
+		{
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+void ScalarPromotion::promote(AddressAccesses& accesses)
+{
+	Value* addr = accesses.mAddr;
+	LoadInst* initial = new LoadInst(addr, addr->getName() + ".promoted",
+									 mPreheader->getTerminator());
+	
+	SSAUpdater updater;
+	updater.Initialize(accesses.mType, initial->getName());
+	updater.AddAvailableValue(mPreheader, initial);
+	
+	// The value at the end of each block is the last one stored there.
+	// (The accesses of each block are in order, since they were
+	// found by walking the block.)
+	for (auto inst : accesses.mInsts)
+	{
+		if (StoreInst* store = dyn_cast<StoreInst>(inst))
+		{
+			updater.AddAvailableValue(store->getParent(), store->getValueOperand());
+		}
+	}
+	
+	// Find what replaces each load before any are removed. A stored value
+	// can itself be a promoted load, which the handles keep track of as
+	// the loads are replaced.
+	std::vector<std::pair<LoadInst*, WeakVH>> replacements;
+	BasicBlock* currBlock = nullptr;
+	Value* currValue = nullptr;
+	for (auto inst : accesses.mInsts)
+	{
+		if (inst->getParent() != currBlock)
+		{
+			currBlock = inst->getParent();
+			currValue = nullptr;
+		}
+		
+		if (StoreInst* store = dyn_cast<StoreInst>(inst))
+		{
+			currValue = store->getValueOperand();
+		}
+		else
+		{
+			// Loads before any store in their block get the value
+			// coming into the block
+			if (currValue == nullptr)
+			{
+				currValue = updater.GetValueInMiddleOfBlock(currBlock);
+			}
+			replacements.push_back(std::make_pair(cast<LoadInst>(inst),
+												  WeakVH(currValue)));
+		}
+	}
+	
+	SmallVector<BasicBlock*, 4> exitBlocks;
+	mCurrLoop->getUniqueExitBlocks(exitBlocks);
+	std::vector<WeakVH> exitValues;
+	for (auto exit : exitBlocks)
+	{
+		exitValues.push_back(WeakVH(updater.GetValueInMiddleOfBlock(exit)));
+	}
+	
+	for (auto& replacement : replacements)
+	{
+		replacement.first->replaceAllUsesWith(replacement.second);
+	}
+	
+	for (unsigned i = 0; i < exitBlocks.size(); i++)
+	{
+		new StoreInst(exitValues[i], addr, exitBlocks[i]->getFirstInsertionPt());
+	}
+	
+	for (auto inst : accesses.mInsts)
+	{
+		inst->eraseFromParent();
+	}
+	
+	mChanged = true;
+}
+
+void ScalarPromotion::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// Only loads, stores and phis change, so the CFG stays the same
+	Info.setPreservesCFG();
+	Info.addRequired<DominatorTreeWrapperPass>();
+	Info.addRequired<LoopInfo>();
+	// A preheader is needed for the initial load, and dedicated
+	// exits for the final stores
+	Info.addRequiredID(LoopSimplifyID);
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::ScalarPromotion::ID = 0;
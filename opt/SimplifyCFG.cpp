@@ -0,0 +1,158 @@
+//
+//  SimplifyCFG.cpp
+//  uscc
+//
+//  Implements CFG simplification --
+//  The if/while emission leaves behind chains of blocks that
+//  just branch to the next one. Blocks that are the only
+//  successor of their only predecessor are merged into it,
+//  and empty blocks that only forward to another block are
+//  removed. This repeats until nothing changes.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/CFG.h>
+#pragma clang diagnostic pop
+#include <vector>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+namespace
+{
+
+// If block's only predecessor unconditionally branches to it,
+// moves block's instructions to the end of the predecessor
+bool mergeIntoPredecessor(BasicBlock* block)
+{
+	BasicBlock* pred = block->getSinglePredecessor();
+	if (pred == nullptr || pred == block)
+	{
+		return false;
+	}
+	
+	BranchInst* br = dyn_cast<BranchInst>(pred->getTerminator());
+	if (br == nullptr || br->isConditional())
+	{
+		return false;
+	}
+	
+	// With one predecessor, each phi has only one value
+	while (PHINode* phi = dyn_cast<PHINode>(block->begin()))
+	{
+		phi->replaceAllUsesWith(phi->getIncomingValue(0));
+		phi->eraseFromParent();
+	}
+	
+	br->eraseFromParent();
+	pred->getInstList().splice(pred->end(), block->getInstList());
+	
+	// Phis in the successors now come from the predecessor
+	block->replaceAllUsesWith(pred);
+	block->eraseFromParent();
+	return true;
+}
+
+// If block is empty except for an unconditional branch,
+// sends its predecessors straight to the branch's target
+bool foldForwardingBlock(BasicBlock* block)
+{
+	BranchInst* br = dyn_cast<BranchInst>(block->begin());
+	if (br == nullptr || br->isConditional() ||
+		block == &block->getParent()->getEntryBlock())
+	{
+		return false;
+	}
+	
+	BasicBlock* succ = br->getSuccessor(0);
+	if (succ == block || pred_begin(block) == pred_end(block))
+	{
+		return false;
+	}
+	
+	std::vector<BasicBlock*> preds(pred_begin(block), pred_end(block));
+	if (isa<PHINode>(succ->begin()))
+	{
+		// If a predecessor already goes to succ, its phi values could
+		// conflict with the ones that came through this block
+		for (BasicBlock* pred : preds)
+		{
+			for (auto it = pred_begin(succ); it != pred_end(succ); ++it)
+			{
+				if (*it == pred)
+				{
+					return false;
+				}
+			}
+		}
+		
+		// The value that came through this block now comes
+		// from each of its predecessors instead
+		for (auto inst = succ->begin(); isa<PHINode>(inst); ++inst)
+		{
+			PHINode* phi = cast<PHINode>(inst);
+			Value* val = phi->removeIncomingValue(block, false);
+			for (BasicBlock* pred : preds)
+			{
+				phi->addIncoming(val, pred);
+			}
+		}
+	}
+	
+	block->replaceAllUsesWith(succ);
+	block->eraseFromParent();
+	return true;
+}
+
+} // anonymous namespace
+
+bool SimplifyCFG::runOnFunction(Function& F)
+{
+	bool changed = false;
+	bool iterChanged = true;
+	while (iterChanged)
+	{
+		iterChanged = false;
+		Function::iterator blockIter = F.begin();
+		while (blockIter != F.end())
+		{
+			// Only the current block can be erased
+			BasicBlock* block = &*blockIter;
+			++blockIter;
+			
+			if (mergeIntoPredecessor(block) || foldForwardingBlock(block))
+			{
+				iterChanged = true;
+				changed = true;
+			}
+		}
+	}
+	
+	return changed;
+}
+
+void SimplifyCFG::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// Execute after dead code has been removed,
+	// since that leaves more empty blocks
+	Info.addRequired<ADCE>();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::SimplifyCFG::ID = 0;
@@ -0,0 +1,363 @@
+//
+//  TailRecursion.cpp
+//  uscc
+//
+//  Implements tail recursion elimination --
+//  A call to the function itself that's immediately returned
+//  is replaced with a branch back to the start of the function,
+//  where phis select the new argument values. Returns of the
+//  form x + f(...) or x * f(...) are also handled, by keeping
+//  a running accumulator. Calls to other functions that are
+//  immediately returned are marked as tail calls.
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/CFG.h>
+#pragma clang diagnostic pop
+#include <vector>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+namespace
+{
+
+// A call whose result is returned right away
+struct TailSite
+{
+	CallInst* mCall;
+	// The add or mul that combines the call's result with
+	// a value computed before the call (or nullptr)
+	BinaryOperator* mAccum;
+};
+
+bool isLifetimeEnd(Instruction* inst)
+{
+	IntrinsicInst* intrinsic = dyn_cast<IntrinsicInst>(inst);
+	return intrinsic != nullptr && intrinsic->getIntrinsicID() == Intrinsic::lifetime_end;
+}
+
+// Whether the address of a local could be seen by a callee. If so,
+// calls can't be tail calls, since the caller's frame has to stay.
+bool allocasEscape(Function& F)
+{
+	std::vector<Instruction*> worklist;
+	for (Instruction& inst : F.getEntryBlock())
+	{
+		if (isa<AllocaInst>(&inst))
+		{
+			worklist.push_back(&inst);
+		}
+	}
+	
+	while (!worklist.empty())
+	{
+		Instruction* addr = worklist.back();
+		worklist.pop_back();
+		for (User* user : addr->users())
+		{
+			Instruction* inst = cast<Instruction>(user);
+			if (isa<GetElementPtrInst>(inst) || isa<CastInst>(inst) ||
+				isa<PHINode>(inst))
+			{
+				worklist.push_back(inst);
+			}
+			else if (StoreInst* store = dyn_cast<StoreInst>(inst))
+			{
+				// Storing the address itself somewhere
+				if (store->getValueOperand() == addr)
+				{
+					return true;
+				}
+			}
+			else if (isa<CallInst>(inst))
+			{
+				if (!isa<IntrinsicInst>(inst) ||
+					(cast<IntrinsicInst>(inst)->getIntrinsicID() != Intrinsic::lifetime_start &&
+					 !isLifetimeEnd(inst)))
+				{
+					return true;
+				}
+			}
+			else if (!isa<LoadInst>(inst))
+			{
+				return true;
+			}
+		}
+	}
+	
+	return false;
+}
+
+// Checks whether call is only followed by returning its result.
+// That's either a ret in the same block, or a branch to a block
+// that does nothing but return (perhaps through a phi).
+bool findTailSite(CallInst* call, TailSite& site)
+{
+	site.mCall = call;
+	site.mAccum = nullptr;
+	Value* result = call;
+	
+	BasicBlock::iterator instrIter = call;
+	++instrIter;
+	for (; !isa<TerminatorInst>(instrIter); ++instrIter)
+	{
+		BinaryOperator* binOp = dyn_cast<BinaryOperator>(instrIter);
+		if (isLifetimeEnd(instrIter))
+		{
+			continue;
+		}
+		else if (binOp != nullptr && site.mAccum == nullptr &&
+				 (binOp->getOpcode() == Instruction::Add ||
+				  binOp->getOpcode() == Instruction::Mul) &&
+				 (binOp->getOperand(0) == call) != (binOp->getOperand(1) == call))
+		{
+			site.mAccum = binOp;
+			result = binOp;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	
+	// The call's value can't be used for anything else
+	if (!call->use_empty() && !call->hasOneUse())
+	{
+		return false;
+	}
+	if (site.mAccum != nullptr && (!call->hasOneUse() || !site.mAccum->hasOneUse()))
+	{
+		return false;
+	}
+	
+	ReturnInst* ret = dyn_cast<ReturnInst>(instrIter);
+	Value* retVal = nullptr;
+	if (ret != nullptr)
+	{
+		retVal = ret->getReturnValue();
+	}
+	else
+	{
+		BranchInst* br = dyn_cast<BranchInst>(instrIter);
+		if (br == nullptr || br->isConditional())
+		{
+			return false;
+		}
+		
+		BasicBlock* retBlock = br->getSuccessor(0);
+		ret = dyn_cast<ReturnInst>(retBlock->getFirstNonPHI());
+		if (ret == nullptr)
+		{
+			return false;
+		}
+		
+		retVal = ret->getReturnValue();
+		if (PHINode* phi = dyn_cast_or_null<PHINode>(retVal))
+		{
+			if (phi->getParent() == retBlock)
+			{
+				retVal = phi->getIncomingValueForBlock(call->getParent());
+			}
+		}
+	}
+	
+	if (retVal == nullptr)
+	{
+		// A void return, so nothing can be accumulated
+		return site.mAccum == nullptr;
+	}
+	
+	return retVal == result;
+}
+
+// Replaces the recursive calls in sites with branches back to the
+// start of F. The new loop header is the old entry block.
+void eliminateTailRecursion(Function& F, const std::vector<TailSite>& sites)
+{
+	BasicBlock* header = &F.getEntryBlock();
+	BasicBlock* entry = BasicBlock::Create(F.getContext(), "entry", &F, header);
+	BranchInst::Create(header, entry);
+	header->setName("tailrecurse");
+	
+	// The allocas have to stay in the entry, so they aren't in the loop
+	BasicBlock::iterator instrIter = header->begin();
+	while (instrIter != header->end())
+	{
+		Instruction* inst = instrIter;
+		++instrIter;
+		if (isa<AllocaInst>(inst))
+		{
+			inst->moveBefore(entry->getTerminator());
+		}
+	}
+	
+	// Every argument now comes from a phi
+	std::vector<PHINode*> argPhis;
+	for (Argument& arg : F.getArgumentList())
+	{
+		PHINode* phi = PHINode::Create(arg.getType(), 2, arg.getName() + ".tr",
+									   header->begin());
+		arg.replaceAllUsesWith(phi);
+		phi->addIncoming(&arg, entry);
+		argPhis.push_back(phi);
+	}
+	
+	// All of the sites that accumulate use the same operation
+	PHINode* accPhi = nullptr;
+	Instruction::BinaryOps accOp = Instruction::Add;
+	for (const TailSite& site : sites)
+	{
+		if (site.mAccum != nullptr)
+		{
+			accOp = site.mAccum->getOpcode();
+			accPhi = PHINode::Create(F.getReturnType(), 2, "accumulator.tr",
+									 header->getFirstNonPHI());
+			accPhi->addIncoming(ConstantInt::get(F.getReturnType(),
+												 accOp == Instruction::Add ? 0 : 1), entry);
+			break;
+		}
+	}
+	
+	for (const TailSite& site : sites)
+	{
+		CallInst* call = site.mCall;
+		BasicBlock* block = call->getParent();
+		for (unsigned i = 0; i < argPhis.size(); i++)
+		{
+			argPhis[i]->addIncoming(call->getArgOperand(i), block);
+		}
+		
+		if (accPhi != nullptr)
+		{
+			Value* accVal = accPhi;
+			if (site.mAccum != nullptr)
+			{
+				// acc op (x op f(...)) is (acc op x) op f(...)
+				Value* other = site.mAccum->getOperand(0) == call ?
+					site.mAccum->getOperand(1) : site.mAccum->getOperand(0);
+				accVal = BinaryOperator::Create(accOp, accPhi, other, "accumulate.tr", call);
+			}
+			accPhi->addIncoming(accVal, block);
+		}
+		
+		TerminatorInst* term = block->getTerminator();
+		if (BranchInst* br = dyn_cast<BranchInst>(term))
+		{
+			br->getSuccessor(0)->removePredecessor(block);
+		}
+		term->eraseFromParent();
+		if (site.mAccum != nullptr)
+		{
+			site.mAccum->eraseFromParent();
+		}
+		call->eraseFromParent();
+		BranchInst::Create(header, block);
+	}
+	
+	// The remaining returns have to include the accumulated value
+	if (accPhi != nullptr)
+	{
+		for (BasicBlock& block : F)
+		{
+			ReturnInst* ret = dyn_cast<ReturnInst>(block.getTerminator());
+			if (ret != nullptr)
+			{
+				Value* val = BinaryOperator::Create(accOp, accPhi, ret->getReturnValue(),
+													"accumulate.ret.tr", ret);
+				ret->setOperand(0, val);
+			}
+		}
+	}
+}
+
+} // anonymous namespace
+
+bool TailRecursion::runOnFunction(Function& F)
+{
+	// Recursive calls can reuse the frame, and others can be
+	// tail calls, only if nothing points into the frame
+	if (allocasEscape(F))
+	{
+		return false;
+	}
+	
+	std::vector<TailSite> recursiveSites;
+	std::vector<CallInst*> tailCalls;
+	Instruction::BinaryOps accOp = Instruction::BinaryOpsEnd;
+	for (BasicBlock& block : F)
+	{
+		for (Instruction& inst : block)
+		{
+			CallInst* call = dyn_cast<CallInst>(&inst);
+			TailSite site;
+			if (call == nullptr || isa<IntrinsicInst>(call) || !findTailSite(call, site))
+			{
+				continue;
+			}
+			
+			// A call with an accumulator still has work left after it
+			if (call->getCalledFunction() != &F)
+			{
+				if (site.mAccum == nullptr)
+				{
+					tailCalls.push_back(call);
+				}
+				continue;
+			}
+			
+			// Only one kind of accumulator is kept
+			if (site.mAccum != nullptr)
+			{
+				if (accOp == Instruction::BinaryOpsEnd)
+				{
+					accOp = site.mAccum->getOpcode();
+				}
+				else if (accOp != site.mAccum->getOpcode())
+				{
+					continue;
+				}
+			}
+			recursiveSites.push_back(site);
+		}
+	}
+	
+	for (CallInst* call : tailCalls)
+	{
+		call->setTailCall();
+	}
+	
+	if (!recursiveSites.empty())
+	{
+		eliminateTailRecursion(F, recursiveSites);
+	}
+	
+	return !tailCalls.empty() || !recursiveSites.empty();
+}
+
+void TailRecursion::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// Execute after the CFG has been cleaned up
+	Info.addRequired<SimplifyCFG>();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::TailRecursion::ID = 0;
@@ -27,6 +27,8 @@
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/Transforms/Utils/PromoteMemToReg.h>
 #pragma clang diagnostic pop
 
 #include <vector>
@@ -36,8 +38,35 @@ using namespace llvm;
 
 #define AST_EMIT(a) llvm::Value* a::emitIR(CodeContext& ctx) noexcept
 
+namespace
+{
+
+// Used by SSAMode::Alloca to turn the allocas of locals
+// into registers once the function has been emitted
+void promoteAllocas(Function& func)
+{
+	std::vector<AllocaInst*> allocas;
+	for (Instruction& inst : func.getEntryBlock())
+	{
+		AllocaInst* alloca = dyn_cast<AllocaInst>(&inst);
+		if (alloca && isAllocaPromotable(alloca))
+		{
+			allocas.push_back(alloca);
+		}
+	}
+	
+	if (!allocas.empty())
+	{
+		DominatorTree domTree;
+		domTree.recalculate(func);
+		PromoteMemToReg(allocas, domTree);
+	}
+}
+
+} // anonymous namespace
+
 // Program/Functions
-AST_EMIT(ASTProgram)
+void ASTProgram::emitDecls(CodeContext& ctx) noexcept
 {
 	ctx.mModule = new Module("main", ctx.mGlobal);
 	
@@ -56,11 +85,20 @@ AST_EMIT(ASTProgram)
 		Function* func = Function::Create(printfType, GlobalValue::LinkageTypes::ExternalLinkage,
 										  "printf", ctx.mModule);
 		func->setCallingConv(CallingConv::C);
-		
-		// Map the printf ident to this function
-		ctx.mPrintfIdent->setAddress(func);
 	}
 	
+	// Declare every function up front, so calls (including ones to
+	// functions that are emitted later) can look them up by name
+	for (auto f : mFuncs)
+	{
+		f->emitPrototype(ctx);
+	}
+}
+
+AST_EMIT(ASTProgram)
+{
+	emitDecls(ctx);
+	
 	// Emit code for all the functions
 	for (auto f : mFuncs)
 	{
@@ -71,7 +109,7 @@ AST_EMIT(ASTProgram)
 	return nullptr;
 }
 
-AST_EMIT(ASTFunction)
+llvm::Function* ASTFunction::emitPrototype(CodeContext& ctx) noexcept
 {
 	FunctionType* funcType = nullptr;
 	
@@ -100,29 +138,47 @@ AST_EMIT(ASTFunction)
 		std::vector<llvm::Type*> args;
 		for (auto arg : mArgs)
 		{
-			args.push_back(arg->getIdent().llvmType());
+			args.push_back(arg->getIdent().llvmType(ctx.mGlobal));
 		}
 		
 		funcType = FunctionType::get(retType, args, false);
 	}
 	
-	// Create the function, and make it the current one
-	ctx.mFunc = Function::Create(funcType,
-								 GlobalValue::LinkageTypes::ExternalLinkage,
-								 mIdent.getName(), ctx.mModule);
+	Function* func = Function::Create(funcType,
+									  GlobalValue::LinkageTypes::ExternalLinkage,
+									  mIdent.getName(), ctx.mModule);
+	func->setCallingConv(CallingConv::C);
+	
+	// Name the arguments
+	int i = 0;
+	for (auto iter = func->arg_begin(); iter != func->arg_end(); ++iter)
+	{
+		iter->setName(mArgs[i]->getIdent().getName());
+		++i;
+	}
+	
+	return func;
+}
+
+AST_EMIT(ASTFunction)
+{
+	// The prototype was already emitted by ASTProgram::emitDecls,
+	// so make it the current function
+	ctx.mFunc = ctx.mModule->getFunction(mIdent.getName());
 	
 	// Now that we have a new function, reset our SSA builder
 	ctx.mSSA.reset();
 	
-	// Map the ident to this function
-	mIdent.setAddress(ctx.mFunc);
-	
 	// Create the entry basic block
 	ctx.mBlock = BasicBlock::Create(ctx.mGlobal, "entry", ctx.mFunc);
 	// Add and seal this block
 	ctx.mSSA.addBlock(ctx.mBlock, true);
 	
-	// If we have arguments, we need to set the name/value of them
+	// Add all the declarations for variables created in this function
+	// (first, so that with SSAMode::Alloca the arguments have a slot)
+	mScopeTable.emitIR(ctx);
+	
+	// If we have arguments, we need to set the value of them
 	if (mArgs.size() > 0)
 	{
 		Function::arg_iterator iter = ctx.mFunc->arg_begin();
@@ -131,13 +187,6 @@ AST_EMIT(ASTFunction)
 		while (iter != end)
 		{
 			Identifier& argIdent = mArgs[i]->getIdent();
-			iter->setName(argIdent.getName());
-			
-			// PA4: Remove the setAddress call
-			// (Technically, iter actually has the value of the
-			// arg, not its address...but we will use the address
-			// member for this value)
-//			argIdent.setAddress(iter);
 			
 			// PA4: Write to this identifier
 			 argIdent.writeTo(ctx, iter);
@@ -147,14 +196,28 @@ AST_EMIT(ASTFunction)
 		}
 	}
 	
-	ctx.mFunc->setCallingConv(CallingConv::C);
-	
-	// Add all the declarations for variables created in this function
-	mScopeTable.emitIR(ctx);
-	
 	// Now emit the body
 	mBody->emitIR(ctx);
 	
+	// The parser makes sure the body ends with a return, so this is only
+	// a safety net for an unreachable block (like the end of an if where
+	// both arms return) that nothing was emitted into
+	if (ctx.mBlock->getTerminator() == nullptr)
+	{
+		IRBuilder<> build(ctx.mBlock);
+		build.CreateUnreachable();
+	}
+	
+	if (ctx.mSSAMode == SSAMode::Alloca)
+	{
+		promoteAllocas(*ctx.mFunc);
+	}
+	else
+	{
+		// Clean up any phis that construction couldn't remove
+		ctx.mSSA.minimizePhis(*ctx.mFunc);
+	}
+	
 	return ctx.mFunc;
 }
 
@@ -187,6 +250,12 @@ AST_EMIT(ASTBadExpr)
 
 AST_EMIT(ASTLogicalAnd)
 {
+	// If the parser simplified this expression, emit that instead
+	if (mFolded)
+	{
+		return mFolded->emitIR(ctx);
+	}
+	
 	// This is extremely similar to logical or
 	
 	// Create the block for the RHS
@@ -264,6 +333,12 @@ AST_EMIT(ASTLogicalAnd)
 
 AST_EMIT(ASTLogicalOr)
 {
+	// If the parser simplified this expression, emit that instead
+	if (mFolded)
+	{
+		return mFolded->emitIR(ctx);
+	}
+	
 	// Create the block for the RHS
 	BasicBlock* rhsBlock = BasicBlock::Create(ctx.mGlobal, "lor.rhs", ctx.mFunc);
 	// Add the rhs block to SSA (not sealed)
@@ -339,6 +414,12 @@ AST_EMIT(ASTLogicalOr)
 
 AST_EMIT(ASTBinaryCmpOp)
 {
+	// If the parser simplified this expression, emit that instead
+	if (mFolded)
+	{
+		return mFolded->emitIR(ctx);
+	}
+	
 	Value* retVal = nullptr;
 	
 	// PA3: Implement
@@ -364,6 +445,12 @@ AST_EMIT(ASTBinaryCmpOp)
 
 AST_EMIT(ASTBinaryMathOp)
 {
+	// If the parser simplified this expression, emit that instead
+	if (mFolded)
+	{
+		return mFolded->emitIR(ctx);
+	}
+	
 	Value* retVal = nullptr;
 	
 	// PA3: Implement
@@ -390,6 +477,12 @@ AST_EMIT(ASTBinaryMathOp)
 // Value -->
 AST_EMIT(ASTNotExpr)
 {
+	// If the parser simplified this expression, emit that instead
+	if (mFolded)
+	{
+		return mFolded->emitIR(ctx);
+	}
+	
 	Value* retVal = nullptr;
 	
 	// PA3: Implement
@@ -417,7 +510,7 @@ AST_EMIT(ASTConstantExpr)
 
 AST_EMIT(ASTStringExpr)
 {
-	return mString->getValue();
+	return ctx.mStringValues[mString];
 }
 
 AST_EMIT(ASTIdentExpr)
@@ -427,6 +520,14 @@ AST_EMIT(ASTIdentExpr)
 
 AST_EMIT(ASTArrayExpr)
 {
+	// Elements of promoted arrays are read like any other variable
+	// (the index is a constant, so there's nothing to emit for it)
+	Identifier& ident = mArray->getIdent();
+	if (ctx.isPromotedArray(ident))
+	{
+		return ctx.mSSA.readElement(&ident, mArray->getConstIndex(), ctx.mBlock);
+	}
+	
 	// Generate the array subscript, which'll give us the address
 	Value* addr = mArray->emitIR(ctx);
 
@@ -475,14 +576,18 @@ AST_EMIT(ASTFuncExpr)
 	// Now call the function, and return it
 	Value* retVal = nullptr;
 	
+	// Functions are looked up by name, since the callee may have been
+	// declared in a different module than the one identified by mIdent
+	Function* callee = ctx.mModule->getFunction(mIdent.getName());
+	
 	IRBuilder<> build(ctx.mBlock);
 	if (mType != Type::Void)
 	{
-		retVal = build.CreateCall(mIdent.getAddress(), callList, "call");
+		retVal = build.CreateCall(callee, callList, "call");
 	}
 	else
 	{
-		retVal = build.CreateCall(mIdent.getAddress(), callList);
+		retVal = build.CreateCall(callee, callList);
 	}
 	
 	return retVal;
@@ -521,6 +626,12 @@ AST_EMIT(ASTAddrOfArray)
 
 AST_EMIT(ASTToIntExpr)
 {
+	// If the parser simplified this expression, emit that instead
+	if (mFolded)
+	{
+		return mFolded->emitIR(ctx);
+	}
+	
 	Value* exprVal = mExpr->emitIR(ctx);
 	IRBuilder<> build(ctx.mBlock);
 	return build.CreateSExt(exprVal, llvm::Type::getInt32Ty(ctx.mGlobal), "conv");
@@ -528,6 +639,12 @@ AST_EMIT(ASTToIntExpr)
 
 AST_EMIT(ASTToCharExpr)
 {
+	// If the parser simplified this expression, emit that instead
+	if (mFolded)
+	{
+		return mFolded->emitIR(ctx);
+	}
+	
 	Value* exprVal = mExpr->emitIR(ctx);
 	IRBuilder<> build(ctx.mBlock);
 	return build.CreateTrunc(exprVal, llvm::Type::getInt8Ty(ctx.mGlobal), "conv");
@@ -545,9 +662,6 @@ AST_EMIT(ASTDecl)
 		// If this is a string, we have to memcpy
 		if (declExpr->getType()->isPointerTy())
 		{
-			// This address should already be saved
-			Value* arrayLoc = mIdent.readFrom(ctx);
-			
 			// GEP the address of the src
 			std::vector<llvm::Value*> gepIdx;
 			gepIdx.push_back(ctx.mZero);
@@ -555,6 +669,17 @@ AST_EMIT(ASTDecl)
 			
 			Value*  src = build.CreateGEP(declExpr, gepIdx);
 			
+			// Unless the array is never written, in which case
+			// it can just point at the string
+			if (mIdent.isConstString())
+			{
+				mIdent.writeTo(ctx, src);
+				return nullptr;
+			}
+			
+			// This address should already be saved
+			Value* arrayLoc = mIdent.readFrom(ctx);
+			
 			// Memcpy into the array
 			// memcpy(dest, src, size, align, volatile)
 			build.CreateMemCpy(arrayLoc, src, mIdent.getArrayCount(), 1);
@@ -573,6 +698,25 @@ AST_EMIT(ASTDecl)
 AST_EMIT(ASTCompoundStmt)
 {
 	// PA3: Implement
+	// Arrays are only live inside their scope, which is what lets
+	// arrays in sibling scopes share stack memory (see ScopeTable)
+	std::vector<std::pair<Value*, ConstantInt*>> arrays;
+	for (auto del : mDecls ) {
+		if (del && ctx.isStackArray(del->getIdent())) {
+			Identifier& ident = del->getIdent();
+			uint64_t size = ident.getArrayCount();
+			if (ident.getType() == Type::IntArray) {
+				size *= 4;
+			}
+			
+			IRBuilder<> build(ctx.mBlock);
+			Value* addr = ident.readFrom(ctx);
+			ConstantInt* sizeVal = build.getInt64(size);
+			build.CreateLifetimeStart(addr, sizeVal);
+			arrays.emplace_back(addr, sizeVal);
+		}
+	}
+	
 	for (auto del : mDecls ) {
 		if (del) {
 			del->emitIR(ctx);
@@ -583,6 +727,14 @@ AST_EMIT(ASTCompoundStmt)
 			stm->emitIR(ctx);
 		}
 	}
+	
+	// If the scope ended with a return, there's nowhere to put these
+	if (ctx.mBlock->getTerminator() == nullptr) {
+		IRBuilder<> build(ctx.mBlock);
+		for (auto& array : arrays) {
+			build.CreateLifetimeEnd(array.first, array.second);
+		}
+	}
 	return nullptr;
 }
 
@@ -605,6 +757,13 @@ AST_EMIT(ASTAssignArrayStmt)
 	// Generate the expression
 	Value* exprVal = mExpr->emitIR(ctx);
 	
+	Identifier& ident = mArray->getIdent();
+	if (ctx.isPromotedArray(ident))
+	{
+		ctx.mSSA.writeElement(&ident, mArray->getConstIndex(), ctx.mBlock, exprVal);
+		return nullptr;
+	}
+	
 	// Generate the array subscript, which'll give us the address
 	Value* addr = mArray->emitIR(ctx);
 
@@ -621,61 +780,58 @@ AST_EMIT(ASTIfStmt)
 	// PA3: Implement
 	IRBuilder<> build(ctx.mGlobal);
 	
+	// Blocks are sealed as soon as all their predecessors exist, so
+	// reads in them never have to create incomplete phis
 	auto thenBlock = BasicBlock::Create(ctx.mGlobal, "if.then", ctx.mFunc);
-	
-	
 	ctx.mSSA.addBlock(thenBlock);
 	
-	
 	//Setup cond for branch
 	auto cond = mExpr->emitIR(ctx);
 	build.SetInsertPoint(ctx.mBlock);
 	auto condResult = build.CreateICmpEQ(cond, ctx.mZero);
-	//Two cases
+	
+	BasicBlock* elseBlock = nullptr;
 	if (mElseStmt) {
-		auto elseBlock = BasicBlock::Create(ctx.mGlobal, "if.else", ctx.mFunc);
-		auto endBlock = BasicBlock::Create(ctx.mGlobal, "if.end", ctx.mFunc);
+		elseBlock = BasicBlock::Create(ctx.mGlobal, "if.else", ctx.mFunc);
 		ctx.mSSA.addBlock(elseBlock);
-		
+	}
+	auto endBlock = BasicBlock::Create(ctx.mGlobal, "if.end", ctx.mFunc);
+	ctx.mSSA.addBlock(endBlock);
+	
+	//Two cases
+	if (mElseStmt) {
 		build.CreateCondBr(condResult, elseBlock, thenBlock);
-		
-		//Else emit and branch
 		ctx.mSSA.sealBlock(elseBlock);
-		ctx.mBlock = elseBlock;
-		mElseStmt->emitIR(ctx);
-		build.SetInsertPoint(ctx.mBlock);
-        ctx.mSSA.addBlock(endBlock);
-		build.CreateBr(endBlock);
-        
-        //Then emit and branch
-        ctx.mSSA.sealBlock(thenBlock);
-        ctx.mBlock = thenBlock;
-        mThenStmt->emitIR(ctx);
-        build.SetInsertPoint(ctx.mBlock);
-        build.CreateBr(endBlock);
-        
-        ctx.mSSA.sealBlock(endBlock);
-        ctx.mBlock = endBlock;
 	} else {
-        auto endBlock = BasicBlock::Create(ctx.mGlobal, "if.end", ctx.mFunc);
-        ctx.mSSA.addBlock(endBlock);
 		build.CreateCondBr(condResult, endBlock, thenBlock);
-        
-        //Then emit and branch
-        ctx.mSSA.sealBlock(thenBlock);
-        ctx.mBlock = thenBlock;
-        mThenStmt->emitIR(ctx);
-        build.SetInsertPoint(ctx.mBlock);
-        build.CreateBr(endBlock);
-        
-        ctx.mSSA.sealBlock(endBlock);
-        ctx.mBlock = endBlock;
 	}
+	ctx.mSSA.sealBlock(thenBlock);
 	
+	//Then emit and branch (unless it ended with a return)
+	ctx.mBlock = thenBlock;
+	mThenStmt->emitIR(ctx);
+	if (ctx.mBlock->getTerminator() == nullptr) {
+		build.SetInsertPoint(ctx.mBlock);
+		build.CreateBr(endBlock);
+	}
+	
+	//Else emit and branch
+	if (mElseStmt) {
+		ctx.mBlock = elseBlock;
+		mElseStmt->emitIR(ctx);
+		if (ctx.mBlock->getTerminator() == nullptr) {
+			build.SetInsertPoint(ctx.mBlock);
+			build.CreateBr(endBlock);
+		}
+	}
 	
+	// If both arms returned, nothing reaches the end block. Any
+	// statements after the if still go there, and ASTFunction
+	// terminates it if they don't.
+	ctx.mSSA.sealBlock(endBlock);
+	ctx.mBlock = endBlock;
 
 	return nullptr;
-
 }
 
 AST_EMIT(ASTWhileStmt)
@@ -684,42 +840,50 @@ AST_EMIT(ASTWhileStmt)
 	IRBuilder<> build(ctx.mGlobal);
 
 	auto condBlock = BasicBlock::Create(ctx.mGlobal, "while.cond", ctx.mFunc);
-//	auto bodyBlock = BasicBlock::Create(ctx.mGlobal, "while.body", ctx.mFunc);
-//	auto endBlock = BasicBlock::Create(ctx.mGlobal, "while.end", ctx.mFunc);
-
 	ctx.mSSA.addBlock(condBlock);
 	
 	//Branch to cond
 	build.SetInsertPoint(ctx.mBlock);
 	build.CreateBr(condBlock);
 	
+	// The back edge to the header doesn't exist until the body is emitted,
+	// but only the variables assigned in the loop can change along it. So
+	// the header is sealed now, with phis for just those variables (which
+	// the sealBlock after the body completes). With allocas, nothing is
+	// read through the builder, so that's skipped.
+	if (ctx.mSSAMode == SSAMode::Builder) {
+		ctx.mSSA.sealLoopHeader(condBlock, mAssigned);
+	}
+	
 	//Branch to body or end based on result
 	ctx.mBlock = condBlock;
 	auto cond = mExpr->emitIR(ctx);
 	build.SetInsertPoint(ctx.mBlock);
 	auto condResult = build.CreateICmpEQ(cond, ctx.mZero);
-    
-    auto bodyBlock = BasicBlock::Create(ctx.mGlobal, "while.body", ctx.mFunc);
+	
+	auto bodyBlock = BasicBlock::Create(ctx.mGlobal, "while.body", ctx.mFunc);
 	ctx.mSSA.addBlock(bodyBlock);
-    auto endBlock = BasicBlock::Create(ctx.mGlobal, "while.end", ctx.mFunc);
+	auto endBlock = BasicBlock::Create(ctx.mGlobal, "while.end", ctx.mFunc);
 	ctx.mSSA.addBlock(endBlock);
 	build.CreateCondBr(condResult, endBlock, bodyBlock);
 	
-    ctx.mSSA.sealBlock(endBlock);
-	//Branch from body to cond
+	// Both are only reached from the condition
+	ctx.mSSA.sealBlock(bodyBlock);
+	ctx.mSSA.sealBlock(endBlock);
+	
+	//Branch from body to cond (unless it ended with a return)
 	ctx.mBlock = bodyBlock;
 	mLoopStmt->emitIR(ctx);
-	build.SetInsertPoint(ctx.mBlock);
-	build.CreateBr(condBlock);
-
+	if (ctx.mBlock->getTerminator() == nullptr) {
+		build.SetInsertPoint(ctx.mBlock);
+		build.CreateBr(condBlock);
+	}
+	
+	// Now that the back edge exists, complete the header's phis
 	ctx.mSSA.sealBlock(condBlock);
-    ctx.mSSA.sealBlock(bodyBlock);
 	
 	//Set mBlock to endBlock
 	ctx.mBlock = endBlock;
-
-	
-	
 	
 	return nullptr;
 }
@@ -727,11 +891,20 @@ AST_EMIT(ASTWhileStmt)
 AST_EMIT(ASTReturnStmt)
 {
 	// PA3: Implement
-	IRBuilder<> build(ctx.mBlock);
+	// A return right after another one is unreachable
+	if (ctx.mBlock->getTerminator() != nullptr) {
+		return nullptr;
+	}
+	
+	// The expression can add blocks (for && and ||), so it's
+	// emitted before deciding where the ret goes
 	if (mExpr) {
-		return build.CreateRet(mExpr->emitIR(ctx));
+		Value* retVal = mExpr->emitIR(ctx);
+		IRBuilder<> build(ctx.mBlock);
+		return build.CreateRet(retVal);
 	}
 	else {
+		IRBuilder<> build(ctx.mBlock);
 		return build.CreateRetVoid();
 	}
 }
@@ -15,11 +15,92 @@
 #include "ASTNodes.h"
 #include "Symbols.h"
 #include <sstream>
+#include <cstdint>
 
 using namespace uscc::parse;
+using namespace uscc::scan;
 
 // Expression AST Nodes
 
+namespace
+{
+
+// Returns the constant this expression is known to evaluate to,
+// or nullptr if its value isn't known until runtime
+ASTConstantExpr* getConstant(const std::shared_ptr<ASTExpr>& expr) noexcept
+{
+	ASTExpr* e = expr.get();
+	if (e && e->getFolded())
+	{
+		e = e->getFolded().get();
+	}
+	
+	return dynamic_cast<ASTConstantExpr*>(e);
+}
+
+// Returns the expression that should stand in for expr
+// if expr was itself simplified
+std::shared_ptr<ASTExpr> simplest(const std::shared_ptr<ASTExpr>& expr) noexcept
+{
+	if (expr->getFolded())
+	{
+		return expr->getFolded();
+	}
+	
+	return expr;
+}
+
+// Returns true if expr is a constant with the requested value
+bool isConstant(const std::shared_ptr<ASTExpr>& expr, int value) noexcept
+{
+	ASTConstantExpr* constExpr = getConstant(expr);
+	return constExpr != nullptr && constExpr->getValue() == value;
+}
+
+// Strips the char -> int conversion (if any) and returns the
+// identifier that's read, or nullptr if this isn't a plain read
+Identifier* getReadIdent(const std::shared_ptr<ASTExpr>& expr) noexcept
+{
+	ASTExpr* e = expr.get();
+	if (ASTToIntExpr* toInt = dynamic_cast<ASTToIntExpr*>(e))
+	{
+		e = toInt->getChild().get();
+	}
+	
+	if (ASTIdentExpr* identExpr = dynamic_cast<ASTIdentExpr*>(e))
+	{
+		return &identExpr->getIdent();
+	}
+	
+	return nullptr;
+}
+
+// Returns true if evaluating this expression can't have side effects,
+// which means it's safe to not emit it at all
+bool isPure(const std::shared_ptr<ASTExpr>& expr) noexcept
+{
+	return getConstant(expr) != nullptr || getReadIdent(expr) != nullptr;
+}
+
+// USC ints are 32-bit two's complement, so wrap the same way LLVM will
+int wrapInt(int64_t value) noexcept
+{
+	return static_cast<int32_t>(static_cast<uint32_t>(value));
+}
+
+// Makes the (lhs != 0) expression used when a logical op
+// reduces to the truth value of just one operand
+std::shared_ptr<ASTExpr> makeToBool(std::shared_ptr<ASTExpr> expr) noexcept
+{
+	auto cmp = std::make_shared<ASTBinaryCmpOp>(Token::NotEqual);
+	cmp->setLHS(expr);
+	cmp->setRHS(std::make_shared<ASTConstantExpr>(0));
+	cmp->finalizeOp();
+	return cmp;
+}
+
+} // anonymous namespace
+
 // Finalize the op.
 // Call this after both lhs/rhs are set, and
 // it will evaluate the type of the expression.
@@ -32,6 +113,38 @@ bool ASTLogicalAnd::finalizeOp() noexcept
 	if (mLHS->getType() != Type::Int) return false;
 	if (mRHS->getType() != Type::Int) return false;
 	
+	ASTConstantExpr* lhs = getConstant(mLHS);
+	ASTConstantExpr* rhs = getConstant(mRHS);
+	if (lhs && rhs)
+	{
+		mFolded = std::make_shared<ASTConstantExpr>(lhs->getValue() != 0 &&
+													rhs->getValue() != 0);
+	}
+	else if (lhs)
+	{
+		// The rhs is never evaluated if the lhs is false,
+		// so it doesn't matter whether or not it's pure
+		if (lhs->getValue() == 0)
+		{
+			mFolded = std::make_shared<ASTConstantExpr>(0);
+		}
+		else
+		{
+			mFolded = makeToBool(mRHS);
+		}
+	}
+	else if (rhs)
+	{
+		if (rhs->getValue() != 0)
+		{
+			mFolded = makeToBool(mLHS);
+		}
+		else if (isPure(mLHS))
+		{
+			mFolded = std::make_shared<ASTConstantExpr>(0);
+		}
+	}
+	
 	return true;
 }
 
@@ -43,6 +156,37 @@ bool ASTLogicalOr::finalizeOp() noexcept
 	if (mLHS->getType() != Type::Int) return false;
 	if (mRHS->getType() != Type::Int) return false;
 	
+	ASTConstantExpr* lhs = getConstant(mLHS);
+	ASTConstantExpr* rhs = getConstant(mRHS);
+	if (lhs && rhs)
+	{
+		mFolded = std::make_shared<ASTConstantExpr>(lhs->getValue() != 0 ||
+													rhs->getValue() != 0);
+	}
+	else if (lhs)
+	{
+		// The rhs is never evaluated if the lhs is true
+		if (lhs->getValue() != 0)
+		{
+			mFolded = std::make_shared<ASTConstantExpr>(1);
+		}
+		else
+		{
+			mFolded = makeToBool(mRHS);
+		}
+	}
+	else if (rhs)
+	{
+		if (rhs->getValue() == 0)
+		{
+			mFolded = makeToBool(mLHS);
+		}
+		else if (isPure(mLHS))
+		{
+			mFolded = std::make_shared<ASTConstantExpr>(1);
+		}
+	}
+	
 	return true;
 }
 
@@ -54,6 +198,32 @@ bool ASTBinaryCmpOp::finalizeOp() noexcept
 	if (mLHS->getType() != Type::Int) return false;
 	if (mRHS->getType() != Type::Int) return false;
 	
+	ASTConstantExpr* lhs = getConstant(mLHS);
+	ASTConstantExpr* rhs = getConstant(mRHS);
+	if (lhs && rhs)
+	{
+		bool result = false;
+		switch (mOp)
+		{
+			case Token::EqualTo:
+				result = lhs->getValue() == rhs->getValue();
+				break;
+			case Token::NotEqual:
+				result = lhs->getValue() != rhs->getValue();
+				break;
+			case Token::LessThan:
+				result = lhs->getValue() < rhs->getValue();
+				break;
+			case Token::GreaterThan:
+				result = lhs->getValue() > rhs->getValue();
+				break;
+			default:
+				return true;
+		}
+		
+		mFolded = std::make_shared<ASTConstantExpr>(result);
+	}
+	
 	return true;
 }
 
@@ -65,9 +235,121 @@ bool ASTBinaryMathOp::finalizeOp() noexcept
 	if (mLHS->getType() != Type::Int) return false;
 	if (mRHS->getType() != Type::Int) return false;
 	
+	ASTConstantExpr* lhs = getConstant(mLHS);
+	ASTConstantExpr* rhs = getConstant(mRHS);
+	if (lhs && rhs)
+	{
+		int64_t l = lhs->getValue();
+		int64_t r = rhs->getValue();
+		switch (mOp)
+		{
+			case Token::Plus:
+				mFolded = std::make_shared<ASTConstantExpr>(wrapInt(l + r));
+				break;
+			case Token::Minus:
+				mFolded = std::make_shared<ASTConstantExpr>(wrapInt(l - r));
+				break;
+			case Token::Mult:
+				mFolded = std::make_shared<ASTConstantExpr>(wrapInt(l * r));
+				break;
+			case Token::Div:
+			case Token::Mod:
+				// Division by zero and INT_MIN / -1 are left for runtime
+				if (r == 0 || (l == INT32_MIN && r == -1))
+				{
+					break;
+				}
+				
+				if (mOp == Token::Div)
+				{
+					mFolded = std::make_shared<ASTConstantExpr>(wrapInt(l / r));
+				}
+				else
+				{
+					mFolded = std::make_shared<ASTConstantExpr>(wrapInt(l % r));
+				}
+				break;
+			default:
+				break;
+		}
+		
+		return true;
+	}
+	
+	// Algebraic identities
+	switch (mOp)
+	{
+		case Token::Plus:
+			// x + 0 = 0 + x = x
+			if (isConstant(mLHS, 0))
+			{
+				mFolded = simplest(mRHS);
+			}
+			else if (isConstant(mRHS, 0))
+			{
+				mFolded = simplest(mLHS);
+			}
+			break;
+		case Token::Minus:
+			// x - 0 = x, x - x = 0
+			if (isConstant(mRHS, 0))
+			{
+				mFolded = simplest(mLHS);
+			}
+			else if (getReadIdent(mLHS) != nullptr &&
+					 getReadIdent(mLHS) == getReadIdent(mRHS))
+			{
+				mFolded = std::make_shared<ASTConstantExpr>(0);
+			}
+			break;
+		case Token::Mult:
+			// x * 1 = 1 * x = x, x * 0 = 0 * x = 0
+			if (isConstant(mLHS, 1))
+			{
+				mFolded = simplest(mRHS);
+			}
+			else if (isConstant(mRHS, 1))
+			{
+				mFolded = simplest(mLHS);
+			}
+			else if ((isConstant(mLHS, 0) && isPure(mRHS)) ||
+					 (isConstant(mRHS, 0) && isPure(mLHS)))
+			{
+				mFolded = std::make_shared<ASTConstantExpr>(0);
+			}
+			break;
+		case Token::Div:
+			// x / 1 = x
+			if (isConstant(mRHS, 1))
+			{
+				mFolded = simplest(mLHS);
+			}
+			break;
+		case Token::Mod:
+			// x % 1 = 0
+			if (isConstant(mRHS, 1) && isPure(mLHS))
+			{
+				mFolded = std::make_shared<ASTConstantExpr>(0);
+			}
+			break;
+		default:
+			break;
+	}
+	
 	return true;
 }
 
+ASTNotExpr::ASTNotExpr(std::shared_ptr<ASTExpr> expr) noexcept
+: mExpr(expr)
+{
+	mType = mExpr->getType();
+	
+	if (ASTConstantExpr* constExpr = getConstant(mExpr))
+	{
+		mFolded = std::make_shared<ASTConstantExpr>(constExpr->getValue() == 0);
+	}
+}
+
 ASTConstantExpr::ASTConstantExpr(const std::string& constStr)
 {
 	// ConstExpr is always evaluated as a 32-bit integer
@@ -127,7 +409,63 @@ ASTStringExpr::ASTStringExpr(const std::string& str, StringTable& tbl)
 	mString = tbl.getString(actStr);
 }
 
+ASTArraySub::ASTArraySub(Identifier& ident, std::shared_ptr<ASTExpr> expr) noexcept
+: mIdent(ident)
+, mExpr(expr)
+, mConstIndex(-1)
+{
+	// Every access has to have a known element for the
+	// array's elements to be promoted to registers
+	ASTConstantExpr* constExpr = getConstant(mExpr);
+	if (constExpr && constExpr->getValue() >= 0 &&
+		static_cast<size_t>(constExpr->getValue()) < mIdent.getArrayCount())
+	{
+		mConstIndex = constExpr->getValue();
+	}
+	else
+	{
+		mIdent.setArrayInMemory();
+	}
+}
+
 void ASTFuncExpr::addArg(std::shared_ptr<ASTExpr> arg) noexcept
 {
+	// Whether the callee writes to an array argument is
+	// only known once the whole program is parsed
+	if (ASTIdentExpr* identExpr = dynamic_cast<ASTIdentExpr*>(arg.get()))
+	{
+		if (identExpr->getIdent().isArray())
+		{
+			identExpr->getIdent().addArrayPassedTo(&mIdent,
+				static_cast<unsigned>(mArgs.size()));
+		}
+	}
+	
 	mArgs.push_back(arg);
 }
+
+ASTToIntExpr::ASTToIntExpr(std::shared_ptr<ASTExpr> expr) noexcept
+: mExpr(expr)
+{
+	mType = Type::Int;
+	
+	// This is a sext from i8, so the value must be taken as a signed char
+	if (ASTConstantExpr* constExpr = getConstant(mExpr))
+	{
+		mFolded = std::make_shared<ASTConstantExpr>(
+			static_cast<int8_t>(constExpr->getValue()));
+	}
+}
+
+ASTToCharExpr::ASTToCharExpr(std::shared_ptr<ASTExpr> expr) noexcept
+: mExpr(expr)
+{
+	mType = Type::Char;
+	
+	// This is a trunc to i8
+	if (ASTConstantExpr* constExpr = getConstant(mExpr))
+	{
+		mFolded = std::make_shared<ASTConstantExpr>(
+			static_cast<int8_t>(constExpr->getValue()), Type::Char);
+	}
+}
@@ -29,6 +29,11 @@ void ASTFunction::addArg(shared_ptr<ASTArgDecl> arg) noexcept
 	mArgs.push_back(arg);
 }
 
+Identifier& ASTFunction::getArgIdent(unsigned int argNum) noexcept
+{
+	return mArgs[argNum]->getIdent();
+}
+
 // Returns true if the type passed in matches the argument
 // declaration for that particular argument
 bool ASTFunction::checkArgType(unsigned int argNum, Type type) const noexcept
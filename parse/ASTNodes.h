@@ -36,6 +36,7 @@ virtual llvm::Value* emitIR(CodeContext& ctx) noexcept override;
 namespace llvm
 {
 	class Value;
+	class Function;
 }
 
 namespace uscc
@@ -63,6 +64,16 @@ class ASTProgram : public ASTNode
 {
 public:
 	void addFunction(std::shared_ptr<ASTFunction> func) noexcept;
+	
+	const std::list<std::shared_ptr<ASTFunction>>& getFunctions() const noexcept
+	{
+		return mFuncs;
+	}
+	
+	// Creates the module, and emits the string table and the
+	// prototype of every function (but none of the bodies)
+	void emitDecls(CodeContext& ctx) noexcept;
+	
 	AST_DECL_PRINT_EMIT();
 private:
 	std::list<std::shared_ptr<ASTFunction>> mFuncs;
@@ -105,6 +116,12 @@ public:
 	
 	Type getArgType(unsigned int argNum) const noexcept;
 	
+	Identifier& getArgIdent(unsigned int argNum) noexcept;
+	
+	// Declares this function in ctx.mModule.
+	// emitIR then emits the body into this declaration.
+	llvm::Function* emitPrototype(CodeContext& ctx) noexcept;
+	
 	AST_DECL_PRINT_EMIT();
 private:
 	std::shared_ptr<ASTCompoundStmt> mBody;
@@ -148,30 +165,50 @@ public:
 	{
 		return mType;
 	}
+	
+	// Returns the simplified form of this expression found
+	// when the node was built, or nullptr if there isn't one
+	std::shared_ptr<ASTExpr> getFolded() const noexcept
+	{
+		return mFolded;
+	}
 protected:
 	// All expressions have a type
 	// (used for semantic evaluation)
 	Type mType;
+	
+	// If the parser could constant fold or algebraically
+	// simplify this expression, this is what gets emitted instead
+	std::shared_ptr<ASTExpr> mFolded;
 };
 
 // Array subscript helper node
 class ASTArraySub : public ASTNode
 {
 public:
-	ASTArraySub(Identifier& ident, std::shared_ptr<ASTExpr> expr) noexcept
-	: mIdent(ident)
-	, mExpr(expr)
-	{ }
+	ASTArraySub(Identifier& ident, std::shared_ptr<ASTExpr> expr) noexcept;
 	
 	Type getType() const noexcept
 	{
 		return mIdent.getType();
 	}
 	
+	Identifier& getIdent() noexcept
+	{
+		return mIdent;
+	}
+	
+	// The index, if it's a constant in bounds (-1 otherwise)
+	int getConstIndex() const noexcept
+	{
+		return mConstIndex;
+	}
+	
 	AST_DECL_PRINT_EMIT();
 private:
 	Identifier& mIdent;
 	std::shared_ptr<ASTExpr> mExpr;
+	int mConstIndex;
 };
 
 // "Bad" expr is returned if a () subexpr fails, so at least
@@ -298,11 +335,7 @@ private:
 class ASTNotExpr : public ASTExpr
 {
 public:
-	ASTNotExpr(std::shared_ptr<ASTExpr> expr) noexcept
-	: mExpr(expr)
-	{
-		mType = mExpr->getType();
-	}
+	ASTNotExpr(std::shared_ptr<ASTExpr> expr) noexcept;
 	AST_DECL_PRINT_EMIT();
 private:
 	std::shared_ptr<ASTExpr> mExpr;
@@ -314,6 +347,14 @@ class ASTConstantExpr : public ASTExpr
 {
 public:
 	ASTConstantExpr(const std::string& constStr);
+	
+	// Used when the parser folds an expression to a known value
+	ASTConstantExpr(int value, Type type = Type::Int) noexcept
+	: mValue(value)
+	{
+		mType = type;
+	}
+	
 	int getValue() const noexcept
 	{
 		return mValue;
@@ -355,7 +396,19 @@ public:
 	: mIdent(ident)
 	{
 		mType = mIdent.getType();
+		
+		// The whole array is passed to a function
+		if (mIdent.isArray())
+		{
+			mIdent.setArrayInMemory();
+		}
+	}
+	
+	Identifier& getIdent() noexcept
+	{
+		return mIdent;
 	}
+	
 	AST_DECL_PRINT_EMIT();
 private:
 	Identifier& mIdent;
@@ -446,6 +499,10 @@ public:
 	: mArray(array)
 	{
 		mType = mArray->getType();
+		
+		// The element could be written through this pointer
+		mArray->getIdent().setArrayInMemory();
+		mArray->getIdent().setArrayWritten();
 	}
 	AST_DECL_PRINT_EMIT();
 private:
@@ -456,11 +513,7 @@ private:
 class ASTToIntExpr : public ASTExpr
 {
 public:
-	ASTToIntExpr(std::shared_ptr<ASTExpr> expr) noexcept
-	: mExpr(expr)
-	{
-		mType = Type::Int;
-	}
+	ASTToIntExpr(std::shared_ptr<ASTExpr> expr) noexcept;
 	
 	std::shared_ptr<ASTExpr> getChild() noexcept
 	{
@@ -476,11 +529,7 @@ private:
 class ASTToCharExpr : public ASTExpr
 {
 public:
-	ASTToCharExpr(std::shared_ptr<ASTExpr> expr) noexcept
-	: mExpr(expr)
-	{
-		mType = Type::Char;
-	}
+	ASTToCharExpr(std::shared_ptr<ASTExpr> expr) noexcept;
 	
 	std::shared_ptr<ASTExpr> getChild() noexcept
 	{
@@ -499,7 +548,19 @@ public:
 	ASTDecl(Identifier& ident, std::shared_ptr<ASTExpr> expr = nullptr) noexcept
 	: mIdent(ident)
 	, mExpr(expr)
-	{ }
+	{
+		// Strings are copied into arrays with a memcpy
+		if (mExpr && mIdent.isArray())
+		{
+			mIdent.setArrayInMemory();
+		}
+	}
+	
+	Identifier& getIdent() noexcept
+	{
+		return mIdent;
+	}
+	
 	AST_DECL_PRINT_EMIT();
 private:
 	Identifier& mIdent;
@@ -544,7 +605,9 @@ public:
 					   std::shared_ptr<ASTExpr> expr) noexcept
 	: mArray(array)
 	, mExpr(expr)
-	{ }
+	{
+		mArray->getIdent().setArrayWritten();
+	}
 	AST_DECL_PRINT_EMIT();
 private:
 	std::shared_ptr<ASTArraySub> mArray;
@@ -570,14 +633,19 @@ private:
 class ASTWhileStmt : public ASTStmt
 {
 public:
-	ASTWhileStmt(std::shared_ptr<ASTExpr> expr, std::shared_ptr<ASTStmt> loopStmt) noexcept
+	ASTWhileStmt(std::shared_ptr<ASTExpr> expr, std::shared_ptr<ASTStmt> loopStmt,
+				 const std::vector<AssignedVar>& assigned) noexcept
 	: mExpr(expr)
 	, mLoopStmt(loopStmt)
+	, mAssigned(assigned)
 	{ }
 	AST_DECL_PRINT_EMIT();
 private:
 	std::shared_ptr<ASTExpr> mExpr;
 	std::shared_ptr<ASTStmt> mLoopStmt;
+	// Variables declared outside the loop that are assigned in
+	// the condition or body (in the order they're first assigned)
+	std::vector<AssignedVar> mAssigned;
 };
 	
 class ASTReturnStmt : public ASTStmt
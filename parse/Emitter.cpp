@@ -29,10 +29,14 @@
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wconversion"
 #include <llvm/IR/Value.h>
+#include <llvm/IR/Instructions.h>
 #include <llvm/PassManager.h>
 #include <llvm/IR/IRPrintingPasses.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/Bitcode/BitcodeWriterPass.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/ErrorOr.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Constants.h>
@@ -52,93 +56,153 @@
 #include <llvm/Support/CommandLine.h>
 #include <llvm/MC/SubtargetFeature.h>
 #include <llvm/IR/Module.h>
+#include <llvm/MC/MCAsmInfo.h>
 #include "../opt/Passes.h"
 #pragma clang diagnostic pop
 
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <cctype>
+
 using namespace uscc::parse;
 using namespace llvm;
 
-extern size_t NUM_COLORS;
+extern thread_local size_t NUM_COLORS;
+extern thread_local std::ostream* REGALLOC_LOG;
 
-CodeContext::CodeContext(StringTable& strings)
-: mGlobal(getGlobalContext())
-, mModule(nullptr)
-, mBlock(nullptr)
-, mStrings(strings)
-, mPrintfIdent(nullptr)
-, mZero(nullptr)
-, mFunc(nullptr)
+namespace
 {
-	
+
+// The native target and the llc options that select our register
+// allocator are process-wide, so they're only set up once no matter
+// how many Emitters are created.
+void initializeTarget()
+{
+	static std::once_flag initFlag;
+	std::call_once(initFlag, []
+	{
+		// This code is copied over from llc
+		InitializeNativeTarget();
+		InitializeNativeTargetAsmPrinter();
+		InitializeNativeTargetAsmParser();
+		
+		PassRegistry *Registry = PassRegistry::getPassRegistry();
+		initializeCore(*Registry);
+		initializeCodeGen(*Registry);
+		initializeLoopStrengthReducePass(*Registry);
+		initializeLowerIntrinsicsPass(*Registry);
+		initializeUnreachableBlockElimPass(*Registry);
+		
+		const char* argv[] = {
+			"uscc",
+			"-optimize-regalloc=true",
+			"-regalloc=uscc"
+		};
+		cl::ParseCommandLineOptions(3, argv, "llvm system compiler\n");
+	});
 }
 
-Emitter::Emitter(Parser& parser) noexcept
-: mContext(parser.mStrings)
+// Parses the bitcode from a worker thread, and moves each function body
+// in it into the function of the same name in dest (replacing any body
+// that function already had). dest must already declare every function
+// and global the worker module does. Returns false (and leaves dest as
+// it was) if the bitcode can't be parsed or something isn't declared.
+bool moveBodies(Module& dest, const std::string& bitcode)
 {
-	if (parser.mNeedPrintf)
+	std::unique_ptr<MemoryBuffer> buffer(MemoryBuffer::getMemBuffer(bitcode, "", false));
+	ErrorOr<Module*> result = parseBitcodeFile(buffer.get(), dest.getContext());
+	if (!result)
 	{
-		mContext.mPrintfIdent = parser.mSymbols.getIdentifier("printf");
+		errs() << "uscc: " << result.getError().message() << "\n";
+		return false;
 	}
 	
-	// Initialize zero
-	mContext.mZero = Constant::getNullValue(IntegerType::getInt32Ty(mContext.mGlobal));
+	std::unique_ptr<Module> src(result.get());
 	
-	// This is what kicks off the generation of the LLVM IR from the AST
-	parser.mRoot->emitIR(mContext);
-}
-
-void Emitter::optimize() noexcept
-{
-	legacy::PassManager pm;
-	uscc::opt::registerOptPasses(pm);
-	pm.run(*mContext.mModule);
-}
-
-void Emitter::print() noexcept
-{
-	legacy::PassManager pm;
-	pm.add(createPrintModulePass(outs()));
-	pm.run(*mContext.mModule);
+	// Check for anything missing before dest is touched, rather than
+	// leaving it with only some of the bodies moved
+	for (Function& srcFunc : *src)
+	{
+		if (!srcFunc.isDeclaration() && dest.getFunction(srcFunc.getName()) == nullptr)
+		{
+			errs() << "uscc: function " << srcFunc.getName() << " is not declared\n";
+			return false;
+		}
+	}
+	
+	for (auto iter = src->global_begin(); iter != src->global_end(); ++iter)
+	{
+		if (dest.getNamedGlobal(iter->getName()) == nullptr)
+		{
+			errs() << "uscc: global " << iter->getName() << " is not declared\n";
+			return false;
+		}
+	}
+	
+	for (Function& srcFunc : *src)
+	{
+		if (srcFunc.isDeclaration())
+		{
+			continue;
+		}
+		
+		// dropAllReferences also deletes the old body, but unlike
+		// deleteBody it leaves the linkage alone
+		Function* destFunc = dest.getFunction(srcFunc.getName());
+		destFunc->dropAllReferences();
+		destFunc->getBasicBlockList().splice(destFunc->end(),
+											 srcFunc.getBasicBlockList());
+		
+		auto destArg = destFunc->arg_begin();
+		for (auto srcArg = srcFunc.arg_begin(); srcArg != srcFunc.arg_end(); ++srcArg)
+		{
+			srcArg->replaceAllUsesWith(destArg);
+			++destArg;
+		}
+	}
+	
+	// The moved bodies still refer to the worker's globals,
+	// so redirect those to dest's
+	for (Function& srcFunc : *src)
+	{
+		srcFunc.replaceAllUsesWith(dest.getOrInsertFunction(srcFunc.getName(),
+															srcFunc.getFunctionType(),
+															srcFunc.getAttributes()));
+	}
+	
+	for (auto iter = src->global_begin(); iter != src->global_end(); ++iter)
+	{
+		iter->replaceAllUsesWith(dest.getNamedGlobal(iter->getName()));
+	}
+	
+	return true;
 }
 
-void Emitter::writeBitcode(const char* fileName) noexcept
+// Runs the per-function optimization passes over the module
+void runOptPasses(Module& mod, unsigned unrollBudget)
 {
 	legacy::PassManager pm;
-	std::string err;
-	raw_fd_ostream file(fileName, err, sys::fs::F_None);
-	pm.add(createBitcodeWriterPass(file));
-	pm.run(*mContext.mModule);
+	uscc::opt::registerOptPasses(pm, unrollBudget);
+	pm.run(mod);
 }
 
-bool Emitter::verify() noexcept
+// Writes the module to a bitcode string
+std::string writeToString(const Module& mod)
 {
-	return !verifyModule(*mContext.mModule);
+	std::string bitcode;
+	raw_string_ostream output(bitcode);
+	WriteBitcodeToFile(&mod, output);
+	output.flush();
+	return bitcode;
 }
 
-// This function will take the bitcode emitted by uscc and convert it to assembly
-bool Emitter::writeAsm(const char *fileName, unsigned long numColors) noexcept
+// Generates native assembly for the module. If privatePrefix is
+// non-null, it's set to the prefix the target uses for private labels.
+bool emitModuleAsm(Module& mod, raw_ostream& output, std::string* privatePrefix = nullptr)
 {
-	NUM_COLORS = static_cast<size_t>(numColors);
-	Module* mod = mContext.mModule;
-	// This code is copied over from llc
-	InitializeNativeTarget();
-	InitializeNativeTargetAsmPrinter();
-	InitializeNativeTargetAsmParser();
-	
-	PassRegistry *Registry = PassRegistry::getPassRegistry();
-	initializeCore(*Registry);
-	initializeCodeGen(*Registry);
-	initializeLoopStrengthReducePass(*Registry);
-	initializeLowerIntrinsicsPass(*Registry);
-	initializeUnreachableBlockElimPass(*Registry);
-	
-	const char* argv[] = {
-		fileName,
-		"-optimize-regalloc=true",
-		"-regalloc=uscc"
-	};
-	cl::ParseCommandLineOptions(3, argv, "llvm system compiler\n");
-	
 	Triple TheTriple;
 	TheTriple.setTriple(sys::getDefaultTargetTriple());
 	
@@ -149,7 +213,7 @@ bool Emitter::writeAsm(const char *fileName, unsigned long numColors) noexcept
 	const Target *TheTarget = TargetRegistry::lookupTarget("", TheTriple,
 														   Error);
 	if (!TheTarget) {
-		errs() << fileName << ": " << Error;
+		errs() << "uscc: " << Error;
 		return false;
 	}
 	
@@ -168,18 +232,12 @@ bool Emitter::writeAsm(const char *fileName, unsigned long numColors) noexcept
 																		 CodeModel::Default, OLvl));
 	assert(target.get() && "Could not allocate target machine!");
 	
-	
-	assert(mod && "Should have exited if we didn't have a module!");
 	TargetMachine &Target = *target.get();
 	
-	
-	sys::fs::OpenFlags OpenFlags = sys::fs::F_None;
-	OpenFlags |= sys::fs::F_Text;
-	tool_output_file *FDOut = new tool_output_file(fileName, Error,
-												   OpenFlags);
-	// Figure out where we are going to send the output.
-	std::unique_ptr<tool_output_file> Out(FDOut);
-	if (!Out) return 1;
+	if (privatePrefix)
+	{
+		*privatePrefix = Target.getMCAsmInfo()->getPrivateGlobalPrefix();
+	}
 	
 	// Build up all of the passes that we want to do to the module.
 	PassManager PM;
@@ -190,27 +248,530 @@ bool Emitter::writeAsm(const char *fileName, unsigned long numColors) noexcept
 		
 	// Add the target data from the target machine, if it exists, or the module.
 	if (const DataLayout *DL = Target.getDataLayout())
-		mod->setDataLayout(DL);
+		mod.setDataLayout(DL);
 	
-	PM.add(new DataLayoutPass(mod));
+	PM.add(new DataLayoutPass(&mod));
 		
 	{
-		formatted_raw_ostream FOS(Out->os());
+		formatted_raw_ostream FOS(output);
 		
 		
 		// Ask the target to add backend passes as necessary.
 		if (Target.addPassesToEmitFile(PM, FOS, TargetMachine::CGFT_AssemblyFile, false,
 									   nullptr, nullptr)) {
-			errs() << fileName << ": target does not support generation of this"
+			errs() << "uscc: target does not support generation of this"
 			<< " file type!\n";
-			return 1;
+			return false;
 		}
 		
-		PM.run(*mod);
+		PM.run(mod);
+	}
+
+	return true;
+}
+
+// Returns true if c can be part of a symbol in the assembly
+bool isSymbolChar(char c)
+{
+	return std::isalnum(static_cast<unsigned char>(c)) ||
+		c == '_' || c == '.' || c == '$';
+}
+
+// Each partition numbers its private labels (.LBB0_1, .Ltmp0, and so on)
+// from scratch, so when partitions are concatenated, every private label
+// gets a prefix unique to its partition. String literals are skipped.
+std::string renamePrivateLabels(const std::string& assembly,
+								const std::string& privatePrefix, unsigned partition)
+{
+	std::string tag = privatePrefix + "P" + std::to_string(partition) + "_";
+	std::string result;
+	result.reserve(assembly.size() + assembly.size() / 8);
+	
+	bool inString = false;
+	size_t i = 0;
+	while (i < assembly.size())
+	{
+		char c = assembly[i];
+		if (inString)
+		{
+			result += c;
+			if (c == '\\' && i + 1 < assembly.size())
+			{
+				result += assembly[++i];
+			}
+			else if (c == '"')
+			{
+				inString = false;
+			}
+			i++;
+		}
+		else if (c == '"')
+		{
+			inString = true;
+			result += c;
+			i++;
+		}
+		else if (isSymbolChar(c))
+		{
+			size_t start = i;
+			while (i < assembly.size() && isSymbolChar(assembly[i]))
+			{
+				i++;
+			}
+			
+			if (!privatePrefix.empty() &&
+				assembly.compare(start, privatePrefix.size(), privatePrefix) == 0)
+			{
+				result += tag;
+				result.append(assembly, start + privatePrefix.size(),
+							  i - start - privatePrefix.size());
+			}
+			else
+			{
+				result.append(assembly, start, i - start);
+			}
+		}
+		else
+		{
+			result += c;
+			i++;
+		}
+	}
+	
+	return result;
+}
+
+} // anonymous namespace
+
+CodeContext::CodeContext(StringTable& strings, LLVMContext& context,
+						 SSAMode ssaMode /* = SSAMode::Builder */)
+: mSSAMode(ssaMode)
+, mGlobal(context)
+, mModule(nullptr)
+, mBlock(nullptr)
+, mStrings(strings)
+, mPrintfIdent(nullptr)
+, mZero(nullptr)
+, mFunc(nullptr)
+{
+	
+}
+
+bool CodeContext::isPromotedArray(const Identifier& ident) const noexcept
+{
+	return mSSAMode == SSAMode::Builder && ident.canPromoteArray();
+}
+
+bool CodeContext::isStackArray(const Identifier& ident) const noexcept
+{
+	// The count is -1 for arrays passed into a function
+	return ident.isArray() && ident.getArrayCount() != static_cast<size_t>(-1) &&
+		!isPromotedArray(ident) && !ident.isConstString();
+}
+
+Emitter::Emitter(Parser& parser, unsigned numThreads /* = 1 */,
+				 SSAMode ssaMode /* = SSAMode::Builder */) noexcept
+: Emitter(parser, getGlobalContext(), numThreads, ssaMode)
+{
+	
+}
+
+Emitter::Emitter(Parser& parser, LLVMContext& context, unsigned numThreads /* = 1 */,
+				 SSAMode ssaMode /* = SSAMode::Builder */) noexcept
+: mContext(parser.mStrings, context, ssaMode)
+{
+	if (parser.mNeedPrintf)
+	{
+		mContext.mPrintfIdent = parser.mSymbols.getIdentifier("printf");
+	}
+	
+	// Initialize zero
+	mContext.mZero = Constant::getNullValue(IntegerType::getInt32Ty(mContext.mGlobal));
+	
+	// This is what kicks off the generation of the LLVM IR from the AST
+	if (numThreads > 1 && parser.mRoot->getFunctions().size() > 1)
+	{
+		emitParallel(parser, numThreads);
+	}
+	else
+	{
+		parser.mRoot->emitIR(mContext);
+	}
+}
+
+void Emitter::emitParallel(Parser& parser, unsigned numThreads) noexcept
+{
+	ASTProgram& program = *parser.mRoot;
+	program.emitDecls(mContext);
+	
+	std::vector<std::shared_ptr<ASTFunction>> funcs(program.getFunctions().begin(),
+													program.getFunctions().end());
+	numThreads = std::min(numThreads, static_cast<unsigned>(funcs.size()));
+	
+	// LLVM contexts can't be shared between threads, so each worker
+	// emits its share of the functions into a module in its own context,
+	// and hands it back as bitcode
+	std::vector<std::string> bitcode(numThreads);
+	std::vector<opt::SSABuilder::Stats> stats(numThreads);
+	std::vector<std::thread> workers;
+	for (unsigned w = 0; w < numThreads; w++)
+	{
+		workers.emplace_back([&, w]
+		{
+			LLVMContext context;
+			CodeContext ctx(mContext.mStrings, context, mContext.mSSAMode);
+			ctx.mPrintfIdent = mContext.mPrintfIdent;
+			ctx.mZero = Constant::getNullValue(IntegerType::getInt32Ty(context));
+			
+			// Every worker declares the same strings and prototypes in the
+			// same order, so they have the same names as in mContext
+			program.emitDecls(ctx);
+			for (size_t i = w; i < funcs.size(); i += numThreads)
+			{
+				funcs[i]->emitIR(ctx);
+			}
+			
+			bitcode[w] = writeToString(*ctx.mModule);
+			stats[w] = ctx.mSSA.getStats();
+			delete ctx.mModule;
+		});
+	}
+	
+	for (auto& t : workers)
+	{
+		t.join();
+	}
+	
+	// Move the bodies into our module. Since every function was already
+	// declared, the order of the functions doesn't depend on the workers.
+	for (unsigned w = 0; w < numThreads; w++)
+	{
+		if (moveBodies(*mContext.mModule, bitcode[w]))
+		{
+			mContext.mSSA.addStats(stats[w]);
+		}
+		else
+		{
+			// Nothing was moved, so emit that worker's functions here instead
+			errs() << "uscc: parallel emission failed, emitting serially\n";
+			for (size_t i = w; i < funcs.size(); i += numThreads)
+			{
+				funcs[i]->emitIR(mContext);
+			}
+		}
+	}
+}
+
+Emitter::~Emitter() noexcept
+{
+	delete mContext.mModule;
+}
+
+void Emitter::countInstructions(size_t& numInsts, size_t& numPhis) const noexcept
+{
+	numInsts = 0;
+	numPhis = 0;
+	for (const Function& func : *mContext.mModule)
+	{
+		for (const BasicBlock& block : func)
+		{
+			for (const Instruction& inst : block)
+			{
+				numInsts++;
+				if (isa<PHINode>(inst))
+				{
+					numPhis++;
+				}
+			}
+		}
+	}
+}
+
+void Emitter::optimize(unsigned numThreads /* = 1 */,
+					   unsigned unrollBudget /* = opt::DEFAULT_UNROLL_BUDGET */) noexcept
+{
+	// Inlining looks across functions, so it always runs on one thread
+	{
+		legacy::PassManager pm;
+		uscc::opt::registerModulePasses(pm);
+		pm.run(*mContext.mModule);
+	}
+	
+	// Count the functions that actually have bodies to optimize
+	unsigned numFuncs = 0;
+	for (Function& func : *mContext.mModule)
+	{
+		if (!func.isDeclaration())
+		{
+			numFuncs++;
+		}
+	}
+	
+	numThreads = std::min(numThreads, numFuncs);
+	if (numThreads <= 1)
+	{
+		runOptPasses(*mContext.mModule, unrollBudget);
+		return;
+	}
+	
+	// All of our passes only look at one function at a time, so each
+	// worker optimizes every Nth function in its own copy of the module.
+	// The copies have to be in separate LLVM contexts, because a context
+	// (and the constants in it) can't be modified by multiple threads.
+	// A worker that fails leaves its output empty.
+	std::string input = writeToString(*mContext.mModule);
+	std::vector<std::string> output(numThreads);
+	std::vector<std::thread> workers;
+	for (unsigned w = 0; w < numThreads; w++)
+	{
+		workers.emplace_back([&, w]
+		{
+			LLVMContext context;
+			std::unique_ptr<MemoryBuffer> buffer(MemoryBuffer::getMemBuffer(input, "", false));
+			ErrorOr<Module*> result = parseBitcodeFile(buffer.get(), context);
+			if (!result)
+			{
+				// The empty output makes optimize fall back to the serial passes
+				return;
+			}
+			
+			std::unique_ptr<Module> mod(result.get());
+			
+			// Drop the bodies that belong to other workers
+			size_t i = 0;
+			for (Function& func : *mod)
+			{
+				if (!func.isDeclaration())
+				{
+					if (i % numThreads != w)
+					{
+						func.deleteBody();
+					}
+					i++;
+				}
+			}
+			
+			runOptPasses(*mod, unrollBudget);
+			output[w] = writeToString(*mod);
+		});
+	}
+	
+	for (auto& t : workers)
+	{
+		t.join();
+	}
+	
+	// Replace the bodies with the optimized ones. Functions keep their
+	// position in the module, so the result matches a serial run.
+	bool failed = std::any_of(output.begin(), output.end(),
+							  [](const std::string& code) { return code.empty(); });
+	for (auto iter = output.begin(); !failed && iter != output.end(); ++iter)
+	{
+		failed = !moveBodies(*mContext.mModule, *iter);
+	}
+	
+	// Otherwise some functions would silently go unoptimized. The passes
+	// can be rerun on bodies that were already moved in.
+	if (failed)
+	{
+		errs() << "uscc: parallel optimization failed, optimizing serially\n";
+		runOptPasses(*mContext.mModule, unrollBudget);
+	}
+}
+
+void Emitter::print() noexcept
+{
+	print(outs());
+}
+
+void Emitter::print(raw_ostream& output) noexcept
+{
+	legacy::PassManager pm;
+	pm.add(createPrintModulePass(output));
+	pm.run(*mContext.mModule);
+}
+
+void Emitter::writeBitcode(const char* fileName) noexcept
+{
+	std::string err;
+	raw_fd_ostream file(fileName, err, sys::fs::F_None);
+	writeBitcode(file);
+}
+
+void Emitter::writeBitcode(raw_ostream& output) noexcept
+{
+	legacy::PassManager pm;
+	pm.add(createBitcodeWriterPass(output));
+	pm.run(*mContext.mModule);
+}
+
+bool Emitter::verify() noexcept
+{
+	return !verifyModule(*mContext.mModule);
+}
+
+Module* Emitter::releaseModule() noexcept
+{
+	Module* mod = mContext.mModule;
+	mContext.mModule = nullptr;
+	return mod;
+}
+
+// This function will take the bitcode emitted by uscc and convert it to assembly
+bool Emitter::writeAsm(const char *fileName, unsigned long numColors,
+					   unsigned numThreads /* = 1 */) noexcept
+{
+	std::string Error;
+	sys::fs::OpenFlags OpenFlags = sys::fs::F_None;
+	OpenFlags |= sys::fs::F_Text;
+	tool_output_file *FDOut = new tool_output_file(fileName, Error,
+												   OpenFlags);
+	// Figure out where we are going to send the output.
+	std::unique_ptr<tool_output_file> Out(FDOut);
+	if (!Error.empty())
+	{
+		errs() << fileName << ": " << Error;
+		return false;
+	}
+	
+	if (!writeAsm(Out->os(), numColors, numThreads))
+	{
+		return false;
 	}
 	
 	// Declare success.
 	Out->keep();
-
+	
 	return true;
 }
+
+bool Emitter::writeAsm(raw_ostream& output, unsigned long numColors,
+					   unsigned numThreads /* = 1 */) noexcept
+{
+	initializeTarget();
+	
+	// NUM_COLORS is per thread, so it's set here and in each partition's
+	// thread. That way Emitters can generate assembly at the same time.
+	NUM_COLORS = static_cast<size_t>(numColors);
+	Module* mod = mContext.mModule;
+	assert(mod && "Should have exited if we didn't have a module!");
+	
+	// Balance the partitions by instruction count. The largest functions
+	// are placed first, each into the partition with the fewest
+	// instructions so far (ties go to the earlier function/partition).
+	std::vector<std::pair<size_t, unsigned>> sizes;
+	unsigned index = 0;
+	for (Function& func : *mod)
+	{
+		if (!func.isDeclaration())
+		{
+			size_t numInsts = 0;
+			for (BasicBlock& block : func)
+			{
+				numInsts += block.size();
+			}
+			sizes.emplace_back(numInsts, index);
+			index++;
+		}
+	}
+	
+	numThreads = std::min(numThreads, index);
+	if (numThreads <= 1)
+	{
+		return emitModuleAsm(*mod, output);
+	}
+	
+	std::stable_sort(sizes.begin(), sizes.end(),
+					 [](const std::pair<size_t, unsigned>& a,
+						const std::pair<size_t, unsigned>& b)
+	{
+		return a.first > b.first;
+	});
+	
+	std::vector<unsigned> partitionOf(index);
+	std::vector<size_t> partitionSize(numThreads, 0);
+	for (auto& size : sizes)
+	{
+		auto smallest = std::min_element(partitionSize.begin(), partitionSize.end());
+		*smallest += size.first;
+		partitionOf[size.second] = static_cast<unsigned>(smallest - partitionSize.begin());
+	}
+	
+	// Each partition is a copy of the module in its own LLVM context,
+	// with only the bodies of its own functions
+	std::string input = writeToString(*mod);
+	std::vector<std::string> assembly(numThreads);
+	std::vector<std::ostringstream> logs(numThreads);
+	std::vector<char> succeeded(numThreads, false);
+	std::vector<std::thread> workers;
+	for (unsigned p = 0; p < numThreads; p++)
+	{
+		workers.emplace_back([&, p]
+		{
+			REGALLOC_LOG = &logs[p];
+			NUM_COLORS = static_cast<size_t>(numColors);
+			
+			LLVMContext context;
+			std::unique_ptr<MemoryBuffer> buffer(MemoryBuffer::getMemBuffer(input, "", false));
+			ErrorOr<Module*> result = parseBitcodeFile(buffer.get(), context);
+			if (!result)
+			{
+				return;
+			}
+			
+			std::unique_ptr<Module> part(result.get());
+			unsigned i = 0;
+			for (Function& func : *part)
+			{
+				if (!func.isDeclaration())
+				{
+					if (partitionOf[i] != p)
+					{
+						func.deleteBody();
+					}
+					i++;
+				}
+			}
+			
+			// The first partition defines all the globals, and the others
+			// only declare them. Private globals are made internal, so
+			// they have a real symbol the other partitions can refer to.
+			for (auto iter = part->global_begin(); iter != part->global_end(); ++iter)
+			{
+				if (iter->hasPrivateLinkage())
+				{
+					iter->setLinkage(GlobalValue::InternalLinkage);
+				}
+				
+				if (p != 0 && iter->hasInitializer())
+				{
+					iter->setInitializer(nullptr);
+					iter->setLinkage(GlobalValue::ExternalLinkage);
+				}
+			}
+			
+			std::string partAsm;
+			std::string privatePrefix;
+			raw_string_ostream partOutput(partAsm);
+			succeeded[p] = emitModuleAsm(*part, partOutput, &privatePrefix);
+			partOutput.flush();
+			
+			assembly[p] = renamePrivateLabels(partAsm, privatePrefix, p);
+		});
+	}
+	
+	for (auto& t : workers)
+	{
+		t.join();
+	}
+	
+	bool success = true;
+	for (unsigned p = 0; p < numThreads; p++)
+	{
+		*REGALLOC_LOG << logs[p].str();
+		output << assembly[p];
+		success = success && succeeded[p];
+	}
+	
+	return success;
+}
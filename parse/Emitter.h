@@ -20,8 +20,18 @@
 #include <llvm/IR/Value.h>
 #pragma clang diagnostic pop
 
+namespace llvm
+{
+	class LLVMContext;
+	class Module;
+	class raw_ostream;
+}
+
+#include <unordered_map>
+
 #include "Types.h"
 #include "../opt/SSABuilder.h"
+#include "../opt/Passes.h"
 
 namespace uscc
 {
@@ -29,16 +39,39 @@ namespace parse
 {
 
 class StringTable;
+class ConstStr;
 class Identifier;
 
+// How local variables are put into SSA form
+enum class SSAMode
+{
+	// Phis are created on the fly by SSABuilder (the default)
+	Builder,
+	// Every local is loaded from and stored to an alloca,
+	// and LLVM's mem2reg promotes them afterwards
+	Alloca
+};
+
 struct CodeContext
 {
-	CodeContext(StringTable& strings);
+	CodeContext(StringTable& strings, llvm::LLVMContext& context,
+				SSAMode ssaMode = SSAMode::Builder);
+	
+	// Whether this array's elements are SSA variables instead of
+	// being stored in an alloca
+	bool isPromotedArray(const Identifier& ident) const noexcept;
+	
+	// Whether this is a local array that needs stack memory
+	bool isStackArray(const Identifier& ident) const noexcept;
 	
 	// Used for our SSA construction algorithm
 	opt::SSABuilder mSSA;
 	
-	// Global context for LLVM
+	// Which SSA construction to use
+	SSAMode mSSAMode;
+	
+	// LLVM context everything is emitted into
+	// (the global context, unless the caller supplies one)
 	llvm::LLVMContext& mGlobal;
 	
 	// Module for this program
@@ -50,6 +83,9 @@ struct CodeContext
 	// String table
 	StringTable& mStrings;
 	
+	// The global emitted for each string in this context's module
+	std::unordered_map<const ConstStr*, llvm::Value*> mStringValues;
+	
 	// This will be non-null if we need extern printf
 	Identifier* mPrintfIdent;
 	
@@ -65,13 +101,51 @@ class Parser;
 class Emitter
 {
 public:
-	Emitter(Parser& parser) noexcept;
-	void optimize() noexcept;
+	// If numThreads is more than 1, function bodies are
+	// emitted in parallel (see emitParallel)
+	Emitter(Parser& parser, unsigned numThreads = 1,
+			SSAMode ssaMode = SSAMode::Builder) noexcept;
+	// Emits into a caller-owned LLVM context, so that separate
+	// compilations can safely run on separate threads
+	Emitter(Parser& parser, llvm::LLVMContext& context, unsigned numThreads = 1,
+			SSAMode ssaMode = SSAMode::Builder) noexcept;
+	~Emitter() noexcept;
+	// If numThreads is more than 1, functions are optimized in parallel.
+	// Loops are only unrolled if the result has at most unrollBudget
+	// instructions (0 disables unrolling).
+	void optimize(unsigned numThreads = 1,
+				  unsigned unrollBudget = opt::DEFAULT_UNROLL_BUDGET) noexcept;
 	void print() noexcept;
+	void print(llvm::raw_ostream& output) noexcept;
 	void writeBitcode(const char* fileName) noexcept;
+	void writeBitcode(llvm::raw_ostream& output) noexcept;
 	bool verify() noexcept;
-	bool writeAsm(const char* fileName, unsigned long numColors) noexcept;
+	// If numThreads is more than 1, the functions are split into that many
+	// partitions (balanced by instruction count) that are compiled in
+	// parallel, and their assembly is concatenated in partition order
+	bool writeAsm(const char* fileName, unsigned long numColors,
+				  unsigned numThreads = 1) noexcept;
+	bool writeAsm(llvm::raw_ostream& output, unsigned long numColors,
+				  unsigned numThreads = 1) noexcept;
+	
+	// Hands ownership of the emitted module to the caller.
+	// The module is only valid as long as its LLVM context is.
+	llvm::Module* releaseModule() noexcept;
+	
+	// Returns how many phis SSA construction created and removed
+	const opt::SSABuilder::Stats& getSSAStats() const noexcept
+	{
+		return mContext.mSSA.getStats();
+	}
+	
+	// Counts the instructions and phis currently in the module
+	void countInstructions(size_t& numInsts, size_t& numPhis) const noexcept;
 private:
+	// Emits the function bodies on worker threads. Each worker has its own
+	// LLVM context and module, and the bodies are then moved into the
+	// pre-declared functions of mContext's module.
+	void emitParallel(Parser& parser, unsigned numThreads) noexcept;
+	
 	CodeContext mContext;
 };
 
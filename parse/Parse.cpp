@@ -21,6 +21,7 @@
 // Used if you want to see each token
 #define DEBUG_PRINT_TOKENS 0
 #include <sstream>
+#include <algorithm>
 
 #if DEBUG_PRINT_TOKENS
 #include <iostream>
@@ -37,35 +38,70 @@ Parser::Parser(const char* fileName, std::ostream* errStream,
 : mCurrToken(Token::Unknown)
 , mFileName(fileName)
 , mFileStream(fileName)
+, mInput(&mFileStream)
 , mErrStream(errStream)
 , mASTStream(ASTStream)
 , mLineNumber(1)
 , mColNumber(1)
 , mUnusedIdent(nullptr)
+, mLexer(nullptr)
 , mNeedPrintf(false)
 , mCheckSemant(true) // PA2: Change to true
 , mOutputSymbols(outputSymbols)
 {
-	if (mFileStream.is_open())
+	if (!mFileStream.is_open())
 	{
-		mLexer = new yyFlexLexer(&mFileStream);
+		throw FileNotFound();
+	}
+	
+	parseInput();
+}
+
+// Performs the parse on source code that's already in memory
+Parser::Parser(const std::string& source, const char* name, std::ostream* errStream,
+			   std::ostream* ASTStream, bool outputSymbols)
+: mCurrToken(Token::Unknown)
+, mFileName(name)
+, mStringStream(source)
+, mInput(&mStringStream)
+, mErrStream(errStream)
+, mASTStream(ASTStream)
+, mLineNumber(1)
+, mColNumber(1)
+, mUnusedIdent(nullptr)
+, mLexer(nullptr)
+, mNeedPrintf(false)
+, mCheckSemant(true)
+, mOutputSymbols(outputSymbols)
+{
+	parseInput();
+}
+
+// Runs the parse on mInput (shared by both constructors)
+void Parser::parseInput()
+{
+	mLexer = new yyFlexLexer(mInput);
+	
+	try
+	{
+		// Get the first token
+		consumeToken();
 		
-		try
-		{
-			// Get the first token
-			consumeToken();
-			
-			// Now start the parse
-			mRoot = parseProgram();
-		}
-		catch (ParseExcept& e)
+		// Now start the parse
+		mRoot = parseProgram();
+		
+		for (Identifier* array : mStringArrays)
 		{
-			reportError(e);
+			std::unordered_set<Identifier*> visited;
+			if (isReadOnlyArray(array, visited))
+			{
+				array->setConstString();
+			}
 		}
 	}
-	else
+	catch (ParseExcept& e)
 	{
-		throw FileNotFound();
+		reportError(e);
 	}
 	
 	if (!IsValid())
@@ -328,19 +364,25 @@ void Parser::displayErrorMsg(const std::string& line, std::shared_ptr<Error> err
 	
 void Parser::displayErrors() noexcept
 {
+	// Errors are only collected if there's nowhere to display them
+	if (mErrStream == nullptr)
+	{
+		return;
+	}
+	
 	// Output errors
 	// Move the filestream back to the start
 	int lineNum = 0;
 	std::string lineTxt;
-	mFileStream.clear();
-	mFileStream.seekg(0, std::ios::beg);
+	mInput->clear();
+	mInput->seekg(0, std::ios::beg);
 	for (auto i = mErrors.begin();
 		 i != mErrors.end();
 		 ++i)
 	{
 		while (lineNum < (*i)->mLineNum)
 		{
-			std::getline(mFileStream, lineTxt);
+			std::getline(*mInput, lineTxt);
 			lineNum++;
 		}
 		
@@ -360,6 +402,60 @@ Identifier* Parser::getVariable(const char* name) noexcept
 	
 }
 
+void Parser::noteAssigned(Identifier* ident, int element /* = -1 */) noexcept
+{
+	if (!mLoopVars.empty())
+	{
+		std::vector<AssignedVar>& assigned = mLoopVars.back().mAssigned;
+		auto iter = std::find_if(assigned.begin(), assigned.end(),
+								 [=](const AssignedVar& var) {
+			return var.mIdent == ident && var.mElement == element;
+		});
+		if (iter == assigned.end())
+		{
+			assigned.push_back(AssignedVar{ident, element});
+		}
+	}
+}
+
+void Parser::noteDeclared(Identifier* ident) noexcept
+{
+	if (!mLoopVars.empty())
+	{
+		mLoopVars.back().mDeclared.push_back(ident);
+	}
+}
+
+bool Parser::isReadOnlyArray(Identifier* array,
+							 std::unordered_set<Identifier*>& visited) noexcept
+{
+	if (array->isArrayWritten())
+	{
+		return false;
+	}
+	
+	// An array that's already visited is either still being checked
+	// (so if it's written, that's found by the call checking it), or
+	// was found to be read-only
+	if (!visited.insert(array).second)
+	{
+		return true;
+	}
+	
+	for (const auto& passedTo : array->getArrayPassedTo())
+	{
+		// printf has no function node, and doesn't write its arguments
+		std::shared_ptr<ASTFunction> func = passedTo.first->getFunction();
+		if (func && passedTo.second < func->getNumArgs() &&
+			!isReadOnlyArray(&func->getArgIdent(passedTo.second), visited))
+		{
+			return false;
+		}
+	}
+	
+	return true;
+}
+
 const char* Parser::getTypeText(Type type) const noexcept
 {
 	switch (type)
@@ -23,8 +23,11 @@
 #include "../scan/Tokens.h"
 #include <initializer_list>
 #include <fstream>
+#include <sstream>
 #include <memory>
 #include <list>
+#include <vector>
+#include <unordered_set>
 #include "ASTNodes.h"
 #include "ParseExcept.h"
 #include "Symbols.h"
@@ -46,6 +49,12 @@ public:
 	Parser(const char* fileName, std::ostream* errStream,
 		   std::ostream* ASTStream, bool outputSymbols);
 	
+	// Performs the parse on source code that's already in memory.
+	// The name is only used when displaying errors.
+	// errStream can be null if errors should only be collected.
+	Parser(const std::string& source, const char* name, std::ostream* errStream,
+		   std::ostream* ASTStream, bool outputSymbols);
+	
 	// Destructor not virtual; I don't expect any inheritance
 	~Parser();
 	
@@ -60,6 +69,26 @@ public:
 		return mErrors.size();
 	}
 	
+	// Struct used to store an error
+	struct Error
+	{
+		Error(const std::string& msg, int lineNum, int colNum)
+		: mMsg(msg)
+		, mLineNum(lineNum)
+		, mColNum(colNum)
+		{ }
+		
+		std::string mMsg;
+		int mLineNum;
+		int mColNum;
+	};
+	
+	// Returns all the errors found during the parse, in order
+	const std::list<std::shared_ptr<Error>>& GetErrors() const noexcept
+	{
+		return mErrors;
+	}
+	
 protected:
 	// Various helper functions
 	
@@ -127,20 +156,6 @@ protected:
 	void reportSemantError(const std::string& msg, int colOverride = -1,
 						   int lineOverride = -1) noexcept;
 	
-	// Struct used to store an error
-	struct Error
-	{
-		Error(const std::string& msg, int lineNum, int colNum)
-		: mMsg(msg)
-		, mLineNum(lineNum)
-		, mColNum(colNum)
-		{ }
-		
-		std::string mMsg;
-		int mLineNum;
-		int mColNum;
-	};
-	
 	// Write an error message to the error stream
 	void displayErrorMsg(const std::string& line, std::shared_ptr<Error> error) noexcept;
 	
@@ -154,6 +169,18 @@ protected:
 	// Returns a char* that contains the type name
 	const char* getTypeText(Type type) const noexcept;
 	
+	// Records that the identifier (or the element of a promotable array)
+	// is assigned or declared inside the innermost while loop being
+	// parsed, if there is one
+	void noteAssigned(Identifier* ident, int element = -1) noexcept;
+	void noteDeclared(Identifier* ident) noexcept;
+	
+	// True if nothing writes to the array's elements, either directly
+	// or in any function it's passed to. visited holds the arrays
+	// already checked, so recursive calls terminate.
+	bool isReadOnlyArray(Identifier* array,
+						 std::unordered_set<Identifier*>& visited) noexcept;
+	
 	// Takes the expression, and if it's an char expression, converts it to an int type
 	// expression.
 	// Otherwise it doesn't do anything.
@@ -227,6 +254,9 @@ private:
 	Parser(const Parser& copy) { }
 	Parser& operator=(const Parser& rhs) { return *this; }
 	
+	// Runs the parse on mInput (shared by both constructors)
+	void parseInput();
+	
 	// Pointer to the root of our AST root
 	std::shared_ptr<ASTProgram> mRoot;
 	
@@ -246,6 +276,10 @@ private:
 	const char* mFileName;
 	// File stream that we use to process the file
 	std::ifstream mFileStream;
+	// Used instead of the file stream for in-memory source
+	std::istringstream mStringStream;
+	// Whichever of the above streams we're parsing
+	std::istream* mInput;
 	// Ostream exceptions should be output to
 	std::ostream* mErrStream;
 	// Ostream for AST output
@@ -254,6 +288,21 @@ private:
 	// Tracks the return type of the current function
 	Type mCurrReturnType;
 	
+	// The variables assigned and declared in each while loop
+	// currently being parsed (innermost last), so that the loop
+	// header only needs phis for variables that change in the loop
+	struct LoopVars
+	{
+		std::vector<AssignedVar> mAssigned;
+		std::vector<Identifier*> mDeclared;
+	};
+	std::vector<LoopVars> mLoopVars;
+	
+	// Char arrays initialized from a string of the same size.
+	// Once parsing is done, the read-only ones are marked as
+	// constant strings.
+	std::vector<Identifier*> mStringArrays;
+	
 	// Current active token
 	uscc::scan::Token::Tokens mCurrToken;
 	
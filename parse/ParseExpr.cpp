@@ -607,7 +607,9 @@ shared_ptr<ASTExpr> Parser::parseIncFactor()
 	// PA1: Implement
 	if (peekToken() == Token::Inc) {
 		consumeToken();
-		retVal = make_shared<ASTIncExpr>(*getVariable(getTokenTxt()));
+		Identifier* ident = getVariable(getTokenTxt());
+		retVal = make_shared<ASTIncExpr>(*ident);
+		noteAssigned(ident);
 
 		consumeToken();
 	}
@@ -627,7 +629,9 @@ shared_ptr<ASTExpr> Parser::parseDecFactor()
 	// PA1: Implement
 	if (peekToken() == Token::Dec) {
 		consumeToken();
-		retVal = make_shared<ASTDecExpr>(*getVariable(getTokenTxt()));
+		Identifier* ident = getVariable(getTokenTxt());
+		retVal = make_shared<ASTDecExpr>(*ident);
+		noteAssigned(ident);
 
 		consumeToken();
 	}
@@ -15,6 +15,7 @@
 
 #include "Parse.h"
 #include "Symbols.h"
+#include <algorithm>
 
 using namespace uscc::parse;
 using namespace uscc::scan;
@@ -57,6 +58,7 @@ shared_ptr<ASTDecl> Parser::parseDecl()
 				reportSemantError("Invalid redeclaration of identifier '" + std::string(getTokenTxt())+ "'");
 			}
 			ident = mSymbols.createIdentifier(getTokenTxt());
+			noteDeclared(ident);
 			
 			
 			consumeToken();
@@ -167,6 +169,13 @@ shared_ptr<ASTDecl> Parser::parseDecl()
 						{
 							reportSemantError("Declared array cannot fit string");
 						}
+						
+						// If there's no room left over, it might be able to
+						// use the string's global (see isReadOnlyArray)
+						if (ident->getArrayCount() == strExpr->getLength() + 1)
+						{
+							mStringArrays.push_back(ident);
+						}
 					}
 				}
 			}
@@ -384,6 +393,10 @@ shared_ptr<ASTStmt> Parser::parseAssignStmt()
 					}
 				}
 				retVal = make_shared<ASTAssignArrayStmt>(arraySub, expr);
+				if (arraySub->getConstIndex() != -1)
+				{
+					noteAssigned(ident, arraySub->getConstIndex());
+				}
 			}
 			else
 			{
@@ -394,6 +407,7 @@ shared_ptr<ASTStmt> Parser::parseAssignStmt()
 				else if (mSymbols.isDeclaredInScope(ident->getName().c_str()) && (ident->getType() == Type::CharArray || ident->getType() == Type::IntArray) ) reportSemantError("Reassignment of arrays is not allowed", col);
 				
 				retVal = make_shared<ASTAssignStmt>(*ident, expr);
+				noteAssigned(ident);
 				
 			}
 			
@@ -452,13 +466,41 @@ shared_ptr<ASTWhileStmt> Parser::parseWhileStmt()
 	// PA1: Implement
 	
 	if (peekAndConsume(Token::Key_while)) {
+		// If there's a parse error, loops inside this one may not
+		// have popped their entries, so go back to this depth after
+		size_t depth = mLoopVars.size();
+		mLoopVars.emplace_back();
+		
 		matchToken(Token::LParen);
 		auto expr = parseExpr();
 		if (!expr) {
+			mLoopVars.resize(depth);
 			throw ParseExceptMsg("Invalid condition for while statement");
 		}
 		matchToken(Token::RParen);
-		retVal = make_shared<ASTWhileStmt>(expr,parseStmt());
+		auto loopStmt = parseStmt();
+		
+		// Variables declared in the loop start over every iteration,
+		// so their values never flow around the loop
+		LoopVars vars = mLoopVars.back();
+		mLoopVars.resize(depth);
+		std::vector<AssignedVar> assigned;
+		for (const AssignedVar& var : vars.mAssigned) {
+			if (std::find(vars.mDeclared.begin(), vars.mDeclared.end(),
+						  var.mIdent) == vars.mDeclared.end()) {
+				assigned.push_back(var);
+			}
+		}
+		
+		// Anything assigned in this loop is assigned in the outer one too
+		for (const AssignedVar& var : vars.mAssigned) {
+			noteAssigned(var.mIdent, var.mElement);
+		}
+		for (Identifier* ident : vars.mDeclared) {
+			noteDeclared(ident);
+		}
+		
+		retVal = make_shared<ASTWhileStmt>(expr, loopStmt, assigned);
 	}
 	
 	
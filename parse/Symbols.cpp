@@ -33,10 +33,10 @@
 
 using namespace uscc::parse;
 
-llvm::Type* Identifier::llvmType(bool treatArrayAsPtr /* = true */) noexcept
+llvm::Type* Identifier::llvmType(llvm::LLVMContext& context,
+								 bool treatArrayAsPtr /* = true */) noexcept
 {
 	llvm::Type* type = nullptr;
-	llvm::LLVMContext& context = llvm::getGlobalContext();
 	switch (mType)
 	{
 		case Type::Char:
@@ -82,49 +82,58 @@ llvm::Type* Identifier::llvmType(bool treatArrayAsPtr /* = true */) noexcept
 llvm::Value* Identifier::readFrom(CodeContext& ctx) noexcept
 {
 	// PA4: Rewrite this entire function
-	return ctx.mSSA.readVariable(this, ctx.mBlock);
-//	llvm::Value* retVal = nullptr;
-//	// Special case for arrays local to this function
-//	if (isArray() && getArrayCount() != -1)
-//	{
-//		retVal = getAddress();
-//	}
-//	else
-//	{
-//		// PA3: Load from the memory address of this identifier
-//		llvm::IRBuilder<> build(ctx.mBlock);
-//		retVal = build.CreateLoad(getAddress());
-//		
-//	}
-//	return retVal;
+	if (ctx.mSSAMode == SSAMode::Builder)
+	{
+		return ctx.mSSA.readVariable(this, ctx.mBlock);
+	}
+	
+	llvm::Value* retVal = nullptr;
+	// Special case for arrays local to this function
+	if (isArray() && getArrayCount() != -1)
+	{
+		retVal = getAddress();
+	}
+	else
+	{
+		// PA3: Load from the memory address of this identifier
+		llvm::IRBuilder<> build(ctx.mBlock);
+		retVal = build.CreateLoad(getAddress());
+	}
+	return retVal;
 }
 
 void Identifier::writeTo(CodeContext& ctx, llvm::Value* value) noexcept
 {
 	// PA4: Rewrite this entire function
-	return ctx.mSSA.writeVariable(this, ctx.mBlock, value);
+	if (ctx.mSSAMode == SSAMode::Builder)
+	{
+		ctx.mSSA.writeVariable(this, ctx.mBlock, value);
+		return;
+	}
+	
 	// Special case for arrays local to this function
-//	if (isArray() && getArrayCount() != -1)
-//	{
-//		setAddress(value);
-//	}
-//	else
-//	{
-//		// PA3: Write to memory address of this identifier
-//		llvm::IRBuilder<> build(ctx.mBlock);
-//		build.CreateStore(value, getAddress());
-//	}
+	if (isArray() && getArrayCount() != -1)
+	{
+		setAddress(value);
+	}
+	else
+	{
+		// PA3: Write to memory address of this identifier
+		llvm::IRBuilder<> build(ctx.mBlock);
+		build.CreateStore(value, getAddress());
+	}
 }
 
 SymbolTable::SymbolTable() noexcept
+: mNumIdentifiers(0)
 {
 	// PA2: Implement
 	mCurrScope = new ScopeTable(nullptr);
-	Identifier *funcId = new Identifier("@@function");
+	Identifier *funcId = new Identifier("@@function", mNumIdentifiers++);
 	funcId->setType(Type::Function);
-	Identifier *varId = new Identifier("@@variable");
+	Identifier *varId = new Identifier("@@variable", mNumIdentifiers++);
 	varId->setType(Type::Int);
-	Identifier *prtId = new Identifier("printf");
+	Identifier *prtId = new Identifier("printf", mNumIdentifiers++);
 	prtId->setType(Type::Function);
 	
 	mCurrScope->addIdentifier(funcId);
@@ -158,7 +167,7 @@ bool SymbolTable::isDeclaredInScope(const char* name) const noexcept
 Identifier* SymbolTable::createIdentifier(const char* name)
 {
 	
-	Identifier* ident = new Identifier(name);
+	Identifier* ident = new Identifier(name, mNumIdentifiers++);
 	// PA2: Add to current scope table
 	if (!isDeclaredInScope(name)) {
 		mCurrScope->addIdentifier(ident);
@@ -259,60 +268,143 @@ Identifier* SymbolTable::ScopeTable::search(const char* name) noexcept
 
 void SymbolTable::ScopeTable::emitIR(CodeContext& ctx)
 {
-	// The ONLY thing we should alloca now are arrays of a specified size
-	// First emit all the symbols in this scope
-	for (auto sym : mSymbols)
+	// With the SSA builder, the ONLY thing we should alloca now are
+	// arrays of a specified size
+	std::vector<StackSlot> slots;
+	assignSlots(ctx, slots);
+	
+	llvm::IRBuilder<> build(ctx.mBlock);
+	for (const StackSlot& slot : slots)
 	{
-		Identifier* ident = sym.second;
-		llvm::IRBuilder<> build(ctx.mBlock);
-
-		llvm::Value* decl = nullptr;
+		Identifier* first = slot.mArrays.front();
+		std::vector<llvm::Value*> gepIdx;
+		gepIdx.push_back(ctx.mZero);
+		gepIdx.push_back(ctx.mZero);
 		
-		std::string name = ident->getName();
-		
-		// It's -1 if it's an array that's passed into a function,
-		// in which case we don't allocate it
-		if (ident->isArray() && ident->getArrayCount() != -1)
+		if (slot.mArrays.size() == 1)
 		{
-			llvm::Type* type = ident->llvmType(false);
+			llvm::Type* type = first->llvmType(ctx.mGlobal, false);
 			// Note we pass in "nullptr" for the array size because that's
 			// handled by the type
-			decl = build.CreateAlloca(type, nullptr, name);
-			llvm::cast<llvm::AllocaInst>(decl)->setAlignment(8);
-			
-			// Make a GEP here so we can access it later on without issue
-			std::vector<llvm::Value*> gepIdx;
-			gepIdx.push_back(ctx.mZero);
-			gepIdx.push_back(ctx.mZero);
+			llvm::AllocaInst* decl = build.CreateAlloca(type, nullptr, first->getName());
+			decl->setAlignment(8);
 			
-			decl = build.CreateInBoundsGEP(decl, gepIdx);
+			// Make a GEP here so we can access it later on without issue,
+			// and save it for this identifier
+			first->writeTo(ctx, build.CreateInBoundsGEP(decl, gepIdx));
+			continue;
+		}
+		
+		// A shared slot is just bytes, which each array casts
+		// to its own element type
+		llvm::Type* type = llvm::ArrayType::get(llvm::Type::getInt8Ty(ctx.mGlobal),
+												slot.mSize);
+		llvm::AllocaInst* decl = build.CreateAlloca(type, nullptr, first->getName());
+		decl->setAlignment(8);
+		llvm::Value* bytes = build.CreateInBoundsGEP(decl, gepIdx);
+		for (Identifier* ident : slot.mArrays)
+		{
+			ident->writeTo(ctx, build.CreatePointerCast(bytes,
+				ident->llvmType(ctx.mGlobal), ident->getName()));
+		}
+	}
+	
+	emitVariables(ctx);
+}
+
+void SymbolTable::ScopeTable::assignSlots(CodeContext& ctx, std::vector<StackSlot>& slots)
+{
+	std::vector<size_t> used;
+	for (auto sym : mSymbols)
+	{
+		Identifier* ident = sym.second;
+		if (!ctx.isStackArray(*ident))
+		{
+			continue;
+		}
+		
+		size_t size = ident->getArrayCount();
+		if (ident->getType() == Type::IntArray)
+		{
+			size *= 4;
+		}
+		
+		// Use the smallest free slot that's big enough, otherwise
+		// grow the biggest free slot, otherwise make a new one
+		size_t best = slots.size();
+		for (size_t i = 0; i < slots.size(); i++)
+		{
+			if (slots[i].mInUse)
+			{
+				continue;
+			}
 			
-			// Now write this GEP and save it for this identifier
-			ident->writeTo(ctx, decl);
+			if (best == slots.size())
+			{
+				best = i;
+			}
+			else if (slots[best].mSize < size)
+			{
+				if (slots[i].mSize > slots[best].mSize)
+				{
+					best = i;
+				}
+			}
+			else if (slots[i].mSize >= size && slots[i].mSize < slots[best].mSize)
+			{
+				best = i;
+			}
+		}
+		
+		if (best == slots.size())
+		{
+			slots.push_back(StackSlot{0, std::vector<Identifier*>(), false});
+		}
+		
+		StackSlot& slot = slots[best];
+		slot.mSize = std::max(slot.mSize, size);
+		slot.mArrays.push_back(ident);
+		slot.mInUse = true;
+		used.push_back(best);
+	}
+	
+	// Our arrays are live throughout the child scopes
+	for (auto table : mChildren)
+	{
+		table->assignSlots(ctx, slots);
+	}
+	
+	for (size_t i : used)
+	{
+		slots[i].mInUse = false;
+	}
+}
+
+void SymbolTable::ScopeTable::emitVariables(CodeContext& ctx)
+{
+	if (ctx.mSSAMode == SSAMode::Alloca)
+	{
+		llvm::IRBuilder<> build(ctx.mBlock);
+		for (auto sym : mSymbols)
+		{
+			Identifier* ident = sym.second;
+			// (Array arguments are pointers, so they get one, too)
+			if (!(ident->isArray() && ident->getArrayCount() != -1) &&
+				!ident->isFunction() && !ident->isDummy())
+			{
+				// Every other local gets a stack slot, which mem2reg
+				// promotes once the function has been emitted. Arguments
+				// are stored to theirs by ASTFunction.
+				ident->setAddress(build.CreateAlloca(ident->llvmType(ctx.mGlobal),
+													 nullptr, ident->getName()));
+			}
 		}
-//		else
-//		{
-//			// PA4: Remove this else case
-//			
-//			// PA3: Alloca the variables local to this function,
-//			// and save the address.
-//			// (Make sure you check for function arguments, which
-//			// will already have a value which we needs to be copied)
-//			decl = build.CreateAlloca(ident->llvmType());
-//			if (ident->getAddress()) {
-//				auto oldVal = ident->getAddress();
-//				ident->setAddress(decl);
-//				ident->writeTo(ctx, oldVal);
-//			} else {
-//				ident->setAddress(decl);
-//			}
-//		}
 	}
 	
 	// Now emit all the variables in the child scope tables
 	for (auto table : mChildren)
 	{
-		table->emitIR(ctx);
+		table->emitVariables(ctx);
 	}
 }
 
@@ -429,6 +521,6 @@ void StringTable::emitIR(CodeContext& ctx) noexcept
 		// Strings are 1-aligned
 		//globVal->setAlignment(1);
 		
-		str->mValue = globVal;
+		ctx.mStringValues[str] = globVal;
 	}
 }
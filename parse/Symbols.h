@@ -18,6 +18,7 @@
 #include <memory>
 #include <unordered_map>
 #include <list>
+#include <vector>
 
 #include "Types.h"
 
@@ -25,6 +26,7 @@ namespace llvm
 {
 	class Value;
 	class Type;
+	class LLVMContext;
 }
 
 namespace uscc
@@ -100,27 +102,103 @@ public:
 		mAddress = value;
 	}
 	
-	llvm::Type* llvmType(bool treatArrayAsPtr = true) noexcept;
+	llvm::Type* llvmType(llvm::LLVMContext& context, bool treatArrayAsPtr = true) noexcept;
 	
 	llvm::Value* readFrom(CodeContext& ctx) noexcept;
 	
 	void writeTo(CodeContext& ctx, llvm::Value* value) noexcept;
 	
+	// Unique (and dense) among the identifiers of one symbol table,
+	// so it can be used as an array index
+	unsigned getId() const noexcept
+	{
+		return mId;
+	}
+	
+	// Called by the parser for any use of a local array that isn't an
+	// element access with a constant index in bounds
+	void setArrayInMemory() noexcept
+	{
+		mArrayInMemory = true;
+	}
+	
+	// True for small local arrays that are only ever accessed with
+	// constant indices, so each element can be an SSA variable
+	bool canPromoteArray() const noexcept
+	{
+		return isArray() && mArrayCount != static_cast<size_t>(-1) &&
+			mArrayCount <= MAX_PROMOTED_ARRAY && !mArrayInMemory;
+	}
+	
+	// Arrays with more elements than this always stay in memory
+	static const size_t MAX_PROMOTED_ARRAY = 16;
+	
+	// Called by the parser when an array's elements may be written
+	void setArrayWritten() noexcept
+	{
+		mArrayWritten = true;
+	}
+	
+	bool isArrayWritten() const noexcept
+	{
+		return mArrayWritten;
+	}
+	
+	// Records that this array is passed as argument argNum of func
+	void addArrayPassedTo(Identifier* func, unsigned argNum)
+	{
+		mArrayPassedTo.emplace_back(func, argNum);
+	}
+	
+	const std::vector<std::pair<Identifier*, unsigned>>& getArrayPassedTo() const noexcept
+	{
+		return mArrayPassedTo;
+	}
+	
+	// Set for char arrays initialized from a string that are never
+	// written, so they can use the string's constant global directly
+	void setConstString() noexcept
+	{
+		mConstString = true;
+	}
+	
+	bool isConstString() const noexcept
+	{
+		return mConstString;
+	}
+	
 private:
 	// Private constructor so only the symbol table can create
-	Identifier(const char* name)
+	Identifier(const char* name, unsigned id)
 	: mName(name)
+	, mId(id)
 	, mFunctionNode(nullptr)
 	, mAddress(nullptr)
 	, mType(Type::Void)
 	, mArrayCount(-1)
+	, mArrayInMemory(false)
+	, mArrayWritten(false)
+	, mConstString(false)
 	{ }
 	
 	std::string mName;
+	unsigned mId;
 	std::shared_ptr<ASTFunction> mFunctionNode;
 	llvm::Value* mAddress;
 	Type mType;
 	size_t mArrayCount;
+	bool mArrayInMemory;
+	bool mArrayWritten;
+	bool mConstString;
+	std::vector<std::pair<Identifier*, unsigned>> mArrayPassedTo;
+};
+
+// A variable assigned in a loop. For the elements of promoted arrays,
+// mElement is the index of the element (it's -1 otherwise).
+struct AssignedVar
+{
+	Identifier* mIdent;
+	int mElement;
 };
 
 // NOTE: I don't use shared_ptrs for the symbol table
@@ -179,8 +257,8 @@ public:
 		Identifier* search(const char* name) noexcept;
 		
 		// Emits declarations for ALL non-function symbols
-		// in this scope. Used to front-load all stack-based variables
-		// to the start of the function
+		// in this scope and its children. Used to front-load all
+		// stack-based variables to the start of the function
 		void emitIR(CodeContext& ctx);
 		
 		// Prints the scope table to the specified stream
@@ -191,6 +269,22 @@ public:
 			return mParent;
 		}
 	private:
+		// Stack memory shared by arrays whose scopes don't overlap
+		struct StackSlot
+		{
+			size_t mSize;
+			std::vector<Identifier*> mArrays;
+			bool mInUse;
+		};
+		
+		// Assigns every array in this scope and its children to a slot.
+		// Arrays in sibling scopes can share a slot, because they're
+		// never live at the same time.
+		void assignSlots(CodeContext& ctx, std::vector<StackSlot>& slots);
+		
+		// Emits the non-array variables of this scope and its children
+		void emitVariables(CodeContext& ctx);
+		
 		// Hash table contains all the identifiers in this scope
 		std::unordered_map<std::string, Identifier*> mSymbols;
 		
@@ -204,6 +298,9 @@ public:
 private:
 	// Pointer to the current scope table
 	ScopeTable* mCurrScope;
+	
+	// Number of identifiers created, used to assign ids
+	unsigned mNumIdentifiers;
 };
 	
 // Used to store/reference constant strings
@@ -213,7 +310,6 @@ class ConstStr
 public:
 	ConstStr(std::string& text)
 	: mText(text)
-	, mValue(nullptr)
 	{
 		
 	}
@@ -222,14 +318,8 @@ public:
 	{
 		return mText;
 	}
-	
-	llvm::Value* getValue() const noexcept
-	{
-		return mValue;
-	}
 private:
 	std::string mText;
-	llvm::Value* mValue;
 };
 	
 class StringTable
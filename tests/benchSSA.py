@@ -0,0 +1,90 @@
+#---------------------------------------------------------
+# Copyright (c) 2014, Sanjay Madhav
+# All rights reserved.
+#
+# This file is distributed under the BSD license.
+# See LICENSE.TXT for details.
+#---------------------------------------------------------
+# Compares the two ways uscc can construct SSA form:
+# the on-the-fly SSA builder and allocas + mem2reg.
+# Every test program with an expected output (plus a
+# generated program with many loops) is compiled both
+# ways, and the emission time, phi count and instruction
+# count reported by --ssa-stats are summed up.
+#
+# Usage: python benchSSA.py [numRuns]
+import subprocess
+import sys
+import os
+import glob
+uscc = "../bin/uscc"
+genFile = "bench_ssa.usc"
+outFile = "bench_ssa.bc"
+modes = ["builder", "alloca"]
+
+# Nested loops with variables that are only read inside
+# them, which is where the two approaches differ most
+def writeProgram(numFuncs):
+	out = open(genFile, "w")
+	for i in range(numFuncs):
+		out.write("int f%d(int x, int y)\n{\n" % i)
+		out.write("\tint sum = 0;\n\tint i = 0;\n")
+		out.write("\twhile (i < x)\n\t{\n\t\tint j = 0;\n")
+		out.write("\t\twhile (j < y)\n\t\t{\n")
+		out.write("\t\t\tif (j == %d)\n\t\t\t{\n\t\t\t\tsum = sum + (x * y);\n\t\t\t}\n" % (i % 5))
+		out.write("\t\t\telse\n\t\t\t{\n\t\t\t\tsum = sum - i;\n\t\t\t}\n")
+		out.write("\t\t\t++j;\n\t\t}\n\t\t++i;\n\t}\n")
+		out.write("\treturn sum;\n}\n\n")
+	out.write("int main()\n{\n\tprintf(\"%d\\n\", f0(3, 4));\n\treturn 0;\n}\n")
+	out.close()
+
+def corpus():
+	files = []
+	for expected in sorted(glob.glob("expected/*.output")):
+		name = os.path.basename(expected)[:-len(".output")] + ".usc"
+		if os.path.isfile(name):
+			files.append(name)
+	files.append(genFile)
+	return files
+
+# Returns (emit time in ms, phis, instructions) for one compile
+def runStats(fileName, mode):
+	output = subprocess.check_output([uscc, "--ssa", mode, "--ssa-stats",
+									  "-o", outFile, fileName],
+									 stderr=subprocess.STDOUT)
+	stats = {}
+	for line in output.decode().splitlines():
+		if ":" in line:
+			key, value = line.rsplit(":", 1)
+			stats[key.strip()] = value.strip()
+	return (float(stats["Emit time (ms)"]), int(stats["Phis"]),
+			int(stats["Instructions"]))
+
+if __name__ == '__main__':
+	if not os.path.isfile(uscc):
+		raise Exception("Can't run without uscc")
+	numRuns = int(sys.argv[1]) if len(sys.argv) > 1 else 5
+	writeProgram(1000)
+	
+	files = corpus()
+	totals = {}
+	for mode in modes:
+		time = 0.0
+		phis = 0
+		insts = 0
+		for fileName in files:
+			# Take the fastest run to cut down on noise
+			runs = [runStats(fileName, mode) for i in range(numRuns)]
+			time += min(run[0] for run in runs)
+			phis += runs[0][1]
+			insts += runs[0][2]
+		totals[mode] = (time, phis, insts)
+		print("%-8s emit %9.3fms  phis %7d  instructions %8d" % (mode, time, phis, insts))
+	
+	base = totals[modes[0]][0]
+	for mode in modes[1:]:
+		print("%s emits %.2fx as fast as %s" % (modes[0], totals[mode][0] / base, mode))
+	
+	for f in [genFile, outFile]:
+		if os.path.isfile(f):
+			os.remove(f)
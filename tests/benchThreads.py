@@ -0,0 +1,64 @@
+#---------------------------------------------------------
+# Copyright (c) 2014, Sanjay Madhav
+# All rights reserved.
+#
+# This file is distributed under the BSD license.
+# See LICENSE.TXT for details.
+#---------------------------------------------------------
+# Measures how the multithreaded stages of uscc scale.
+# Generates a program with thousands of functions, then
+# times uscc on it with an increasing number of threads.
+#
+# Usage: python benchThreads.py [numFuncs] [maxThreads]
+import subprocess
+import sys
+import time
+import os
+uscc = "../bin/uscc"
+benchFile = "bench_threads.usc"
+
+# Each function has a loop with invariant code, so there's
+# something for every -O pass to do
+def writeProgram(numFuncs):
+	out = open(benchFile, "w")
+	for i in range(numFuncs):
+		out.write("int f%d(int x)\n{\n" % i)
+		out.write("\tint sum = 0;\n\tint i = x;\n")
+		out.write("\twhile (i > 0)\n\t{\n")
+		out.write("\t\tint inv = (x * %d) + (2 * 3);\n" % (i + 1))
+		out.write("\t\tif (1 == 1)\n\t\t{\n\t\t\tsum = sum + (inv - i);\n\t\t}\n")
+		out.write("\t\t--i;\n\t}\n")
+		out.write("\treturn sum;\n}\n\n")
+	out.write("int main()\n{\n\tint total = 0;\n")
+	for i in range(0, numFuncs, max(1, numFuncs // 16)):
+		out.write("\ttotal = total + f%d(10);\n" % i)
+	out.write("\tprintf(\"%d\\n\", total);\n\treturn 0;\n}\n")
+	out.close()
+
+def timeRun(args):
+	start = time.time()
+	subprocess.check_call([uscc] + args + [benchFile])
+	return time.time() - start
+
+if __name__ == '__main__':
+	if not os.path.isfile(uscc):
+		raise Exception("Can't run without uscc")
+	numFuncs = int(sys.argv[1]) if len(sys.argv) > 1 else 4000
+	maxThreads = int(sys.argv[2]) if len(sys.argv) > 2 else 8
+	writeProgram(numFuncs)
+
+	stages = [("emit", []), ("opt", ["-O"]), ("codegen", ["-s"])]
+	for name, extra in stages:
+		base = None
+		threads = 1
+		while threads <= maxThreads:
+			elapsed = timeRun(extra + ["--" + name + "-threads", str(threads)])
+			if base is None:
+				base = elapsed
+			print("%-7s threads=%-2d %7.3fs  speedup %.2fx" % (name, threads, elapsed, base / elapsed))
+			threads *= 2
+
+	os.remove(benchFile)
+	for ext in [".bc", ".s"]:
+		if os.path.isfile("bench_threads" + ext):
+			os.remove("bench_threads" + ext)
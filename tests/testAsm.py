@@ -23,14 +23,14 @@ class AsmTests(unittest.TestCase):
 		if not os.path.isfile(uscc):
 			raise Exception("Can't run without uscc")
 
-	def checkEmit(self, fileName):
+	def checkEmit(self, fileName, usccArgs=[]):
 		# read in expected
 		expectFile = open("expected/" + fileName + ".output", "r")
 		expectedStr = expectFile.read()
 		expectFile.close()
 		# first compile to asm via uscc
 		try:
-			resultStr = subprocess.check_output([uscc, "-s", fileName + ".usc"], stderr=subprocess.STDOUT)
+			resultStr = subprocess.check_output([uscc, "-s"] + usccArgs + [fileName + ".usc"], stderr=subprocess.STDOUT)
 		except subprocess.CalledProcessError as e:
 			self.fail("\n" + e.output)
 		
@@ -83,6 +83,9 @@ class AsmTests(unittest.TestCase):
 	def test_Asm_quicksort(self):
 		self.checkEmit("quicksort")
 		
+	def test_Asm_threads_quicksort(self):
+		self.checkEmit("quicksort", ["--codegen-threads", "3"])
+		
 	def test_Asm_015(self):
 		self.checkEmit("test015")
 		
@@ -24,14 +24,14 @@ class EmitTests(unittest.TestCase):
 		if not os.path.isfile(lli):
 			raise Exception("lli not found at ../../bin/lli")
 
-	def checkEmit(self, fileName):
+	def checkEmit(self, fileName, usccArgs=[]):
 		# read in expected
 		expectFile = open("expected/" + fileName + ".output", "r")
 		expectedStr = expectFile.read()
 		expectFile.close()
 		# first compile the .bc using uscc
 		try:
-			subprocess.check_call([uscc, fileName + ".usc"], stderr=subprocess.STDOUT)
+			subprocess.check_call([uscc] + usccArgs + [fileName + ".usc"], stderr=subprocess.STDOUT)
 		except subprocess.CalledProcessError as e:
 			self.fail("\n" + e.output)
 		
@@ -41,6 +41,17 @@ class EmitTests(unittest.TestCase):
 			self.assertMultiLineEqual(expectedStr, resultStr)
 		except subprocess.CalledProcessError as e:
 			self.fail("\n" + e.output)
+	
+	def checkEmitThreads(self, fileName):
+		# the IR emitted in parallel must match the serial IR exactly
+		try:
+			serialStr = subprocess.check_output([uscc, "-p", fileName + ".usc"], stderr=subprocess.STDOUT)
+			parallelStr = subprocess.check_output([uscc, "-p", "--emit-threads", "4", fileName + ".usc"], stderr=subprocess.STDOUT)
+			self.assertMultiLineEqual(serialStr, parallelStr)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+		
+		self.checkEmit(fileName)
 			
 	def test_Emit_emit02(self):
 		self.checkEmit("emit02")
@@ -75,9 +86,33 @@ class EmitTests(unittest.TestCase):
 	def test_Emit_emit12(self):
 		self.checkEmit("emit12")
 		
+	def test_Emit_emit13(self):
+		self.checkEmit("emit13")
+		
+	def test_Emit_ssa02(self):
+		self.checkEmit("ssa02")
+		
+	def test_Emit_ssa03(self):
+		self.checkEmit("ssa03")
+		
+	def test_Emit_conststr01(self):
+		self.checkEmit("conststr01")
+		
+	def test_Emit_stack01(self):
+		self.checkEmit("stack01")
+		
 	def test_Emit_quicksort(self):
 		self.checkEmit("quicksort")
 		
+	def test_Emit_threads_quicksort(self):
+		self.checkEmitThreads("quicksort")
+		
+	def test_Emit_alloca_ssa02(self):
+		self.checkEmit("ssa02", ["--ssa", "alloca"])
+		
+	def test_Emit_alloca_quicksort(self):
+		self.checkEmit("quicksort", ["--ssa", "alloca"])
+		
 	def test_Emit_015(self):
 		self.checkEmit("test015")
 		
@@ -104,5 +139,32 @@ class EmitTests(unittest.TestCase):
 		
 	def test_Emit_opt07(self):
 		self.checkEmit("opt07")
+		
+	def test_Emit_opt08(self):
+		self.checkEmit("opt08")
+		
+	def test_Emit_opt09(self):
+		self.checkEmit("opt09")
+		
+	def test_Emit_opt10(self):
+		self.checkEmit("opt10")
+		
+	def test_Emit_opt11(self):
+		self.checkEmit("opt11")
+		
+	def test_Emit_opt12(self):
+		self.checkEmit("opt12")
+		
+	def test_Emit_opt13(self):
+		self.checkEmit("opt13")
+		
+	def test_Emit_opt14(self):
+		self.checkEmit("opt14")
+		
+	def test_Emit_opt15(self):
+		self.checkEmit("opt15")
+		
+	def test_Emit_opt16(self):
+		self.checkEmit("opt16")
 if __name__ == '__main__':
 	unittest.main(verbosity=2)
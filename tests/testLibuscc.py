@@ -0,0 +1,40 @@
+#---------------------------------------------------------
+# Copyright (c) 2014, Sanjay Madhav
+# All rights reserved.
+#
+# This file is distributed under the BSD license.
+# See LICENSE.TXT for details.
+#---------------------------------------------------------
+import subprocess
+import os
+import sys
+
+import unittest
+compilertest = "../bin/compilertest"
+
+__unittest = True
+
+class LibusccTests(unittest.TestCase):
+	
+	def setUp(self):
+		self.maxDiff = None
+		if not os.path.isfile(compilertest):
+			raise Exception("Can't run without compilertest")
+
+	def checkDriver(self, testName):
+		# the driver prints what failed and exits with 1
+		try:
+			subprocess.check_output([compilertest, testName], stderr=subprocess.STDOUT)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+			
+	def test_Libuscc_valid(self):
+		self.checkDriver("valid")
+		
+	def test_Libuscc_diagnostics(self):
+		self.checkDriver("diagnostics")
+		
+	def test_Libuscc_takemodule(self):
+		self.checkDriver("takemodule")
+if __name__ == '__main__':
+	unittest.main(verbosity=2)
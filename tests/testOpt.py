@@ -41,6 +41,35 @@ class EmitTests(unittest.TestCase):
 			self.assertMultiLineEqual(expectedStr, resultStr)
 		except subprocess.CalledProcessError as e:
 			self.fail("\n" + e.output)
+	
+	def checkOptThreads(self, fileName):
+		# the IR optimized in parallel must match the serial IR exactly
+		try:
+			serialStr = subprocess.check_output([uscc, "-O", "-p", fileName + ".usc"], stderr=subprocess.STDOUT)
+			parallelStr = subprocess.check_output([uscc, "-O", "-p", "--opt-threads", "4", fileName + ".usc"], stderr=subprocess.STDOUT)
+			self.assertMultiLineEqual(serialStr, parallelStr)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+		
+		self.checkEmit(fileName)
+	
+	def checkInlining(self, fileName, inlined, notInlined):
+		# main's optimized IR must not call the inlined functions,
+		# but must still call the ones that weren't
+		try:
+			resultStr = subprocess.check_output([uscc, "-O", "-p", fileName + ".usc"], stderr=subprocess.STDOUT)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+		
+		mainStart = resultStr.find("define i32 @main()")
+		self.assertNotEqual(mainStart, -1)
+		mainStr = resultStr[mainStart:resultStr.find("\n}", mainStart)]
+		for func in inlined:
+			self.assertNotIn("@" + func + "(", mainStr)
+		for func in notInlined:
+			self.assertIn("@" + func + "(", mainStr)
+		
+		self.checkEmit(fileName)
 			
 	def test_Emit_emit02(self):
 		self.checkEmit("emit02")
@@ -75,9 +104,27 @@ class EmitTests(unittest.TestCase):
 	def test_Emit_emit12(self):
 		self.checkEmit("emit12")
 		
+	def test_Emit_emit13(self):
+		self.checkEmit("emit13")
+		
+	def test_Emit_ssa02(self):
+		self.checkEmit("ssa02")
+		
+	def test_Emit_ssa03(self):
+		self.checkEmit("ssa03")
+		
+	def test_Emit_conststr01(self):
+		self.checkEmit("conststr01")
+		
+	def test_Emit_stack01(self):
+		self.checkEmit("stack01")
+		
 	def test_Emit_quicksort(self):
 		self.checkEmit("quicksort")
 		
+	def test_Emit_threads_quicksort(self):
+		self.checkOptThreads("quicksort")
+		
 	def test_Emit_015(self):
 		self.checkEmit("test015")
 		
@@ -104,5 +151,33 @@ class EmitTests(unittest.TestCase):
 		
 	def test_Emit_opt07(self):
 		self.checkEmit("opt07")
+		
+	def test_Emit_opt08(self):
+		self.checkEmit("opt08")
+		
+	def test_Emit_opt09(self):
+		self.checkEmit("opt09")
+		
+	def test_Emit_opt10(self):
+		self.checkEmit("opt10")
+		
+	def test_Emit_opt11(self):
+		# scale is small enough to inline, but fact is recursive
+		self.checkInlining("opt11", ["scale"], ["fact"])
+		
+	def test_Emit_opt12(self):
+		self.checkEmit("opt12")
+		
+	def test_Emit_opt13(self):
+		self.checkEmit("opt13")
+		
+	def test_Emit_opt14(self):
+		self.checkEmit("opt14")
+		
+	def test_Emit_opt15(self):
+		self.checkEmit("opt15")
+		
+	def test_Emit_opt16(self):
+		self.checkEmit("opt16")
 if __name__ == '__main__':
 	unittest.main(verbosity=2)
@@ -18,6 +18,8 @@
 #include "../parse/ParseExcept.h"
 #include "../parse/Emitter.h"
 #include <iostream>
+#include <chrono>
+#include <string>
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcast-qual"
 #pragma clang diagnostic push
@@ -26,6 +28,11 @@
 #include "ezOptionParser.hpp"
 #pragma clang diagnostic pop
 #pragma GCC diagnostic pop
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Support/raw_ostream.h>
+#pragma clang diagnostic pop
 
 using namespace uscc;
 
@@ -65,6 +72,35 @@ int main(int argc, const char * argv[])
 			" are not installed. GCC or clang can turn this assembly file into an executable.",
 			"-s", "--assembly");
 	opt.add("4", false, 1, 0, "Specify number of colors for register graph coloring", "--num-colors");
+	opt.add("builder", false, 1, 0,
+			"Specify how local variables are put into SSA form. "
+			"\"builder\" (DEFAULT) creates phis during emission, "
+			"\"alloca\" emits loads and stores to allocas and then runs mem2reg.",
+			"--ssa");
+	opt.add("", false, 0, 0,
+			"Output statistics about SSA construction to stderr: the time taken to emit, "
+			"the number of phis created and removed, and the resulting instruction count.",
+			"--ssa-stats");
+	opt.add("1", false, 1, 0,
+			"Specify number of threads used to emit function bodies. "
+			"The emitted IR is the same regardless of the number of threads.",
+			"--emit-threads");
+	opt.add("1", false, 1, 0,
+			"Specify number of threads used to optimize functions with -O. "
+			"The optimized IR is the same regardless of the number of threads.",
+			"--opt-threads");
+	opt.add(std::to_string(uscc::opt::DEFAULT_UNROLL_BUDGET).c_str(), false, 1, 0,
+			"Specify the most instructions a loop may have after it's unrolled with -O. "
+			"0 disables loop unrolling.",
+			"--unroll-budget");
+	opt.add("", false, 0, 0,
+			"Output statistics about the optimization passes to stderr with -O, "
+			"such as the number of instructions they removed.",
+			"--opt-stats");
+	opt.add("1", false, 1, 0,
+			"Specify number of threads used to generate assembly with -s. "
+			"Functions are split into this many partitions, which are compiled in parallel.",
+			"--codegen-threads");
 	opt.add("", false, 1, 0,
 			"Specify output file. This is ignored if -b and -s are specified simultaneously.",
 			"-o", "--output");
@@ -119,13 +155,64 @@ int main(int argc, const char * argv[])
 			return 0;
 		}
 		
+		std::string ssaName;
+		opt.get("--ssa")->getString(ssaName);
+		parse::SSAMode ssaMode = parse::SSAMode::Builder;
+		if (ssaName == "alloca")
+		{
+			ssaMode = parse::SSAMode::Alloca;
+		}
+		else if (ssaName != "builder")
+		{
+			std::cerr << "uscc: error: Unknown SSA mode " << ssaName << "." << std::endl;
+			return 1;
+		}
+		
 		// Now emit LLVM bitcode
-		parse::Emitter emit(parser);
+		unsigned long emitThreads = 1;
+		opt.get("--emit-threads")->getULong(emitThreads);
+		auto emitStart = std::chrono::steady_clock::now();
+		parse::Emitter emit(parser, static_cast<unsigned>(emitThreads), ssaMode);
+		std::chrono::duration<double, std::milli> emitTime =
+			std::chrono::steady_clock::now() - emitStart;
+		
+		if (opt.isSet("--ssa-stats"))
+		{
+			size_t numInsts = 0;
+			size_t numPhis = 0;
+			emit.countInstructions(numInsts, numPhis);
+			std::cerr << "SSA mode: " << ssaName << std::endl;
+			std::cerr << "Emit time (ms): " << emitTime.count() << std::endl;
+			// mem2reg doesn't report how many phis it tried
+			if (ssaMode == parse::SSAMode::Builder)
+			{
+				const auto& stats = emit.getSSAStats();
+				std::cerr << "SSA phis created: " << stats.mCreated << std::endl;
+				std::cerr << "  trivial removed: " << stats.mTrivial << std::endl;
+				std::cerr << "  redundant SCC removed: " << stats.mRedundant << std::endl;
+				std::cerr << "  dead removed: " << stats.mDead << std::endl;
+			}
+			std::cerr << "Phis: " << numPhis << std::endl;
+			std::cerr << "Instructions: " << numInsts << std::endl;
+		}
 		
 		// Check if we should run optimization passes
 		if (opt.isSet("-O"))
 		{
-			emit.optimize();
+			unsigned long optThreads = 1;
+			opt.get("--opt-threads")->getULong(optThreads);
+			unsigned long unrollBudget = uscc::opt::DEFAULT_UNROLL_BUDGET;
+			opt.get("--unroll-budget")->getULong(unrollBudget);
+			if (opt.isSet("--opt-stats"))
+			{
+				llvm::EnableStatistics();
+			}
+			emit.optimize(static_cast<unsigned>(optThreads),
+						  static_cast<unsigned>(unrollBudget));
+			if (opt.isSet("--opt-stats"))
+			{
+				llvm::PrintStatistics(llvm::errs());
+			}
 		}
 		
 		bool shouldEmitBC = true;
@@ -200,7 +287,10 @@ int main(int argc, const char * argv[])
 			ez::OptionGroup* params = opt.get("--num-colors");
 			unsigned long numColors = 4;
 			params->getULong(numColors);
-			if (!emit.writeAsm(asmFile.c_str(), numColors))
+			unsigned long codegenThreads = 1;
+			opt.get("--codegen-threads")->getULong(codegenThreads);
+			if (!emit.writeAsm(asmFile.c_str(), numColors,
+							   static_cast<unsigned>(codegenThreads)))
 			{
 				std::cerr << "uscc: error: Unable to emit assembly. Compilation halted." << std::endl;
 			}